@@ -48,11 +48,13 @@ void Usage(const char *ErrorMessage, ...)
    }
 
   printf("Usage: GDSIIConvert File.GDS [options]\n");
+  printf("       (File.GDS may be gzip-compressed, e.g. File.GDS.gz, or - to read from stdin)\n");
   printf("Options: \n");
   printf("\n");
   printf(" ** Output formats: ** \n");
   printf("   --raw              raw dump of file data records\n");
   printf("   --analyze          detailed listing of hierarchical structure \n");
+  printf("   --stats            predicted size of the flattened geometry, per layer and per cell\n");
   printf("   --GMSH             Export GMSH geometry to FileBase.geo (text strings to FileBase.pp)\n");
   printf("   --scuff-rf         Write .port file defining RF ports for scuff-RF (implies --gmsh)\n");
   printf("\n");
@@ -60,6 +62,13 @@ void Usage(const char *ErrorMessage, ...)
   printf("   --MetalLayer     12  define layer 12 as a metal layer (may be specified multiple times)\n");
   printf("   --LengthUnit     xx  set output length unit in meters (default = 1e-6)\n");
   printf("   --FileBase       xx  set base name for output files\n");
+  printf("   --NumThreads     4   parse structures on 4 threads\n");
+  printf("   --Struct         xx  read only structure xx (located via index file File.GDS.idx)\n");
+  printf("   --IndexFile      xx  use xx as the index file\n");
+  printf("   --TopCell        xx  read only structure xx and the structures it references\n");
+  printf("   --Layer          12  read only elements on layer 12 (may be specified multiple times)\n");
+  printf("   --DataType        0  read only elements of datatype 0 (may be specified multiple times)\n");
+  printf("   --Library    Lib.GDS  resolve references to cells in Lib.GDS (may be specified multiple times)\n");
   printf("   --verbose            produce more output\n");
   printf("   --SeparateLayers     write separate output files for objects on each layer\n");
   exit(1);
@@ -67,14 +76,35 @@ void Usage(const char *ErrorMessage, ...)
 
 typedef struct GDSIIOptions
  { char *GDSIIFile;
-   bool Raw, Analyze, WriteGMSH, WritePorts;
+   bool Raw, Analyze, Stats, WriteGMSH, WritePorts;
    double CoordinateLengthUnit;
    char *FileBase;
    bool Verbose;
    bool SeparateLayers;
    iVec MetalLayers;
+   iVec ReadLayers;
+   iVec ReadDataTypes;
+   strVec Libraries;
+   int NumThreads;
+   char *StructName;
+   char *IndexFile;
+   char *TopCell;
  } GDSIIOptions;
 
+/***************************************************************/
+/* true for file names like File.gds, File.GDSII, File.gds.gz  */
+/***************************************************************/
+bool IsGDSIIFileName(const char *FileName)
+{
+  string Name(FileName);
+  size_t Dot = Name.rfind('.');
+  if (Dot!=string::npos && !strcasecmp(Name.c_str()+Dot, ".gz"))
+   { Name.erase(Dot);
+     Dot = Name.rfind('.');
+   }
+  return Dot!=string::npos && !strncasecmp(Name.c_str()+Dot, ".gds", 4);
+}
+
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
@@ -90,24 +120,29 @@ GDSIIOptions *ProcessGDSIIOptions(int argc, char *argv[])
   Options->GDSIIFile            = 0;
   Options->Raw                  = false;
   Options->Analyze              = false;
+  Options->Stats                = false;
   Options->WriteGMSH            = false;
   Options->WritePorts           = false;
   Options->CoordinateLengthUnit = 1.0e-6;
   Options->FileBase             = 0;
   Options->Verbose              = false;
   Options->SeparateLayers       = false;
+  Options->NumThreads           = 0;
+  Options->StructName           = 0;
+  Options->IndexFile            = 0;
+  Options->TopCell              = 0;
 
   int narg=1;
   for(; narg<argc; narg++)
    { 
-     char *Extension = strrchr(argv[narg],'.');
-
      // try to process the argument as one of our boolean flags
      bool ProcessedArg=true;
      if (!strcasecmp(argv[narg],"--raw"))
       Options->Raw=true;
      else if (!strcasecmp(argv[narg],"--analyze"))
       Options->Analyze=true;
+     else if (!strcasecmp(argv[narg],"--stats"))
+      Options->Stats=true;
      else if (!strcasecmp(argv[narg],"--GMSH"))
       Options->WriteGMSH=true;
      else if (!strcasecmp(argv[narg],"--scuff-rf"))
@@ -116,7 +151,7 @@ GDSIIOptions *ProcessGDSIIOptions(int argc, char *argv[])
       Options->Verbose=true;
      else if (!strcasecmp(argv[narg],"--SeparateLayers"))
       Options->SeparateLayers=true; 
-     else if (Extension && !strncasecmp(Extension,".gds", 4)) // try to process as GDSII filename
+     else if (IsGDSIIFileName(argv[narg]) || !strcmp(argv[narg],"-")) // try to process as GDSII filename
       { if (Options->GDSIIFile!=0)
          GDSIIData::ErrExit("more than one GDSII file specified (%s,%s)",argv[1],Options->GDSIIFile);
         Options->GDSIIFile = argv[narg];
@@ -143,9 +178,25 @@ GDSIIOptions *ProcessGDSIIOptions(int argc, char *argv[])
       GDSIIData::LogFileName=strdup(argv[++narg]);
      else if (!strcasecmp(argv[narg],"--LengthUnit"))
       sscanf(argv[++narg],"%le",&Options->CoordinateLengthUnit);
+     else if (!strcasecmp(argv[narg],"--NumThreads"))
+      sscanf(argv[++narg],"%i",&Options->NumThreads);
+     else if (!strcasecmp(argv[narg],"--Struct"))
+      Options->StructName=argv[++narg];
+     else if (!strcasecmp(argv[narg],"--IndexFile"))
+      Options->IndexFile=argv[++narg];
+     else if (!strcasecmp(argv[narg],"--TopCell"))
+      Options->TopCell=argv[++narg];
      else if (!strcasecmp(argv[narg],"--MetalLayer"))
       { int nml; if (1==sscanf(argv[++narg],"%i",&nml)) Options->MetalLayers.push_back(nml);
       }
+     else if (!strcasecmp(argv[narg],"--Library"))
+      Options->Libraries.push_back(argv[++narg]);
+     else if (!strcasecmp(argv[narg],"--Layer"))
+      { int nl; if (1==sscanf(argv[++narg],"%i",&nl)) Options->ReadLayers.push_back(nl);
+      }
+     else if (!strcasecmp(argv[narg],"--DataType"))
+      { int ndt; if (1==sscanf(argv[++narg],"%i",&ndt)) Options->ReadDataTypes.push_back(ndt);
+      }
      else
       Usage("unknown argument %s",argv[narg]);
    }
@@ -153,9 +204,21 @@ GDSIIOptions *ProcessGDSIIOptions(int argc, char *argv[])
   if (Options->GDSIIFile==0)
    Usage("no GDSII file specified");
 
+  // standard input can only be read once, from start to finish
+  if ( !strcmp(Options->GDSIIFile,"-") )
+   { if (Options->Raw || Options->StructName || Options->TopCell || Options->Libraries.size()>0)
+      Usage("--raw, --Struct, --TopCell, and --Library require a GDSII file name");
+     if (Options->FileBase==0)
+      Options->FileBase = strdup("stdin");
+   }
+
   if (Options->FileBase==0)
    { Options->FileBase = strdup(Options->GDSIIFile);
      char *s=strrchr(Options->FileBase,'.');
+     if (s && !strcasecmp(s,".gz"))
+      { s[0]=0;
+        s=strrchr(Options->FileBase,'.');
+      }
      if (s) s[0]=0;
      s=strrchr(s,'/');
      if (s) Options->FileBase=s+1;
@@ -212,12 +275,15 @@ void WriteGeometryAndPorts(GDSIIData *gdsIIData, GDSIIOptions *Options)
   char *ppFileName = GDSIIData::vstrdup("%s.pp", Options->FileBase);
   FILE *ppFile=0;
   int NumTextStrings=0;
+  gdsIIData->FlattenLayers();
   for(size_t nl=0; nl<Layers.size(); nl++)
-   for(size_t ne=0; ne<gdsIIData->ETable[nl].size(); ne++)
-    if (gdsIIData->ETable[nl][ne].Text)
-     { WriteGMSHEntity(gdsIIData->ETable[nl][ne], Layers[nl], 0, 0, ppFileName, &ppFile);
-       NumTextStrings++;
-     }
+   { const EntityList &Entities = gdsIIData->GetEntities(nl);
+     for(size_t ne=0; ne<Entities.size(); ne++)
+      if (Entities[ne].Text)
+       { WriteGMSHEntity(Entities[ne], Layers[nl], 0, 0, ppFileName, &ppFile);
+         NumTextStrings++;
+       }
+   }
   if (ppFile)
    { fclose(ppFile);
      printf("Wrote %i text strings to %s.\n",NumTextStrings,ppFileName);
@@ -237,7 +303,7 @@ void WriteGeometryAndPorts(GDSIIData *gdsIIData, GDSIIOptions *Options)
         /* For each text string in this layer that labels a port terminal, */
         /* look for a polygon on this layer that contains its base point.  */
         /*******************************************************************/
-        EntityList Entities = gdsIIData->ETable[nl]; // list of all entities on this layer
+        EntityList Entities = gdsIIData->GetEntities(nl); // list of all entities on this layer
         int PortTerminalsThisLayer=0;
         for(size_t ne=0; ne<Entities.size(); ne++)
          { 
@@ -311,7 +377,7 @@ void WriteGeometryAndPorts(GDSIIData *gdsIIData, GDSIIOptions *Options)
       }
 
      printf("Detecting metallization structures on layer %3i: ",Layers[nl]);
-     EntityList Entities = gdsIIData->ETable[nl]; // list of all entities on this layer
+     const EntityList &Entities = gdsIIData->GetEntities(nl); // list of all entities on this layer
      int PolygonsThisLayer=0;
      for(size_t ne=0; ne<Entities.size(); ne++)
       { Entity E=Entities[ne];
@@ -388,6 +454,50 @@ unsigned long GetMemoryUsage(unsigned long *MemoryUsage)
   return 0;
 }
 
+/***************************************************************/
+/* Print the number of polygons, vertices, and bytes that      */
+/* flattening would produce, for the whole design on each      */
+/* layer and for each cell on all layers (on each layer, with  */
+/* --verbose).                                                 */
+/***************************************************************/
+void WriteStatistics(GDSIIData *Data, GDSIIOptions *Options)
+{
+  vector<FlatSizeList> CellSizes;
+  FlatSizeList Sizes = Data->EstimateFlatSize(iVec(), &CellSizes);
+
+  printf("Flattened geometry:\n");
+  printf("%8s %14s %14s %10s %14s\n","layer","polygons","vertices","texts","bytes");
+  FlatSize Total={-1, 0, 0, 0, 0, 0};
+  for(size_t n=0; n<Sizes.size(); n++)
+   { printf("%8i %14zu %14zu %10zu %14zu\n",Sizes[n].Layer,
+             Sizes[n].NumPolygons,Sizes[n].NumVertices,Sizes[n].NumTexts,Sizes[n].NumBytes);
+     Total.NumPolygons += Sizes[n].NumPolygons;
+     Total.NumVertices += Sizes[n].NumVertices;
+     Total.NumTexts    += Sizes[n].NumTexts;
+     Total.NumBytes    += Sizes[n].NumBytes;
+   }
+  printf("%8s %14zu %14zu %10zu %14zu\n","total",
+          Total.NumPolygons,Total.NumVertices,Total.NumTexts,Total.NumBytes);
+
+  printf("\nFlattened cells:\n");
+  printf("%-24s %8s %14s %14s %10s %14s\n","cell","layer","polygons","vertices","texts","bytes");
+  for(size_t ns=0; ns<CellSizes.size(); ns++)
+   { FlatSize CellTotal={-1, 0, 0, 0, 0, 0};
+     for(size_t n=0; n<CellSizes[ns].size(); n++)
+      { const FlatSize &Size = CellSizes[ns][n];
+        if (Options->Verbose)
+         printf("%-24s %8i %14zu %14zu %10zu %14zu\n",Data->Structs[ns]->Name->c_str(),Size.Layer,
+                 Size.NumPolygons,Size.NumVertices,Size.NumTexts,Size.NumBytes);
+        CellTotal.NumPolygons += Size.NumPolygons;
+        CellTotal.NumVertices += Size.NumVertices;
+        CellTotal.NumTexts    += Size.NumTexts;
+        CellTotal.NumBytes    += Size.NumBytes;
+      }
+     printf("%-24s %8s %14zu %14zu %10zu %14zu\n",Data->Structs[ns]->Name->c_str(),"all",
+             CellTotal.NumPolygons,CellTotal.NumVertices,CellTotal.NumTexts,CellTotal.NumBytes);
+   }
+}
+
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
@@ -401,9 +511,16 @@ int main(int argc, char *argv[])
   /***************************************************************/
   /* dump raw file data (before reading GDSII data) if requested */
   /***************************************************************/
-  if (Options->Raw) DumpGDSIIFile(Options->GDSIIFile);
+  if (Options->Raw) DumpGDSIIFile(Options->GDSIIFile, Options->StructName);
 
+  bool ReadStdin = !strcmp(Options->GDSIIFile,"-");
 #if 1
+// the memory profile reads the whole file, which would defeat
+// reading a single structure through the index, only the
+// structures below a top cell, or only some layers and datatypes
+if (    !ReadStdin && Options->Libraries.size()==0
+     && !Options->StructName && !Options->TopCell
+     && Options->ReadLayers.size()==0 && Options->ReadDataTypes.size()==0 )
 {
   if (GDSIIData::LogFileName==0) GDSIIData::LogFileName=strdup("/tmp/GDSIIConvert.log");
   unsigned long MemBefore[MEMORY_USAGE_SLOTS];
@@ -423,7 +540,26 @@ n,MemBefore[n],MemDuring[n],MemAfter[n],MemAfter[n]-MemBefore[n]);
   /***************************************************************/
   /* try to read in the GDSII file                               */
   /***************************************************************/
-  GDSIIData *gdsIIData  = new GDSIIData( string(Options->GDSIIFile) );
+  GDSIIReadOptions ReadOptions;
+  ReadOptions.NumThreads = Options->NumThreads;
+  if (Options->StructName)
+   ReadOptions.StructName = Options->StructName;
+  if (Options->IndexFile)
+   ReadOptions.IndexFileName = Options->IndexFile;
+  if (Options->TopCell)
+   ReadOptions.TopCell = Options->TopCell;
+  ReadOptions.Layers = Options->ReadLayers;
+  ReadOptions.DataTypes = Options->ReadDataTypes;
+  GDSIIData *gdsIIData;
+  if (ReadStdin)
+   gdsIIData = new GDSIIData( 0, ReadOptions );
+  else if (Options->Libraries.size()>0)
+   { strVec FileNames(1, Options->GDSIIFile);
+     FileNames.insert(FileNames.end(), Options->Libraries.begin(), Options->Libraries.end());
+     gdsIIData = new GDSIIData( FileNames, ReadOptions );
+   }
+  else
+   gdsIIData = new GDSIIData( string(Options->GDSIIFile), ReadOptions );
   if (gdsIIData->ErrMsg)
    { printf("error: %s (aborting)\n",gdsIIData->ErrMsg->c_str());
      exit(1);
@@ -434,6 +570,8 @@ n,MemBefore[n],MemDuring[n],MemAfter[n],MemAfter[n]-MemBefore[n]);
   /***************************************************************/
   if (Options->Analyze)
    gdsIIData->WriteDescription();
+  if (Options->Stats)
+   WriteStatistics(gdsIIData, Options);
   
   /****************************************************************/
   /* Flatten hierarchy, then write geometry and (optionally) ports*/
@@ -27,6 +27,8 @@
 #include <math.h>
 #include <string>
 #include <sstream>
+#include <algorithm>
+#include <limits>
 
 #include "libGDSII.h"
 
@@ -37,54 +39,649 @@ namespace libGDSII{
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
+/* affine transform XP = A*X + T taking the coordinates of a  */
+/* structure to those of the top-level structure into which it */
+/* is being flattened, classified so that the per-vertex      */
+/* kernel can skip the arithmetic that is known to be trivial  */
+/***************************************************************/
+enum GTClass { GT_IDENTITY, GT_TRANSLATE, GT_SCALE, GT_ROT90, GT_GENERAL };
+
 typedef struct GTransform
- { double X0, Y0;
-   double CosTheta, SinTheta;
-   double Mag;
-   bool Refl;
+ { double A11, A12, A21, A22; // rotation, magnification, reflection
+   double X0, Y0;             // translation
+   GTClass Class;
+   bool Rigid;                // true if A is a rotation or reflection (no magnification)
  } GTransform;
 
 typedef vector<GTransform> GTVec;
 
-static void ApplyGTransform(GTransform GT, double X, double Y, double *XP, double *YP)
+static void ClassifyGTransform(GTransform *GT)
+{
+  bool Translated = (GT->X0!=0.0 || GT->Y0!=0.0);
+  if (GT->A12==0.0 && GT->A21==0.0)
+   { if (GT->A11==1.0 && GT->A22==1.0)
+      GT->Class = Translated ? GT_TRANSLATE : GT_IDENTITY;
+     else
+      GT->Class = GT_SCALE;
+   }
+  else if (GT->A11==0.0 && GT->A22==0.0)
+   GT->Class = GT_ROT90;
+  else
+   GT->Class = GT_GENERAL;
+}
+
+// cosine and sine of an angle in degrees, exact for multiples of 90 degrees
+static void GetCosSin(double Angle, double *Cos, double *Sin)
+{
+  double Quadrants = Angle/90.0;
+  if (Quadrants==floor(Quadrants))
+   { static const double C[4]={1.0,0.0,-1.0,0.0}, S[4]={0.0,1.0,0.0,-1.0};
+     int nq = ((int)fmod(Quadrants,4.0) + 4) % 4;
+     *Cos=C[nq];
+     *Sin=S[nq];
+   }
+  else
+   { *Cos=cos(Angle*M_PI/180.0);
+     *Sin=sin(Angle*M_PI/180.0);
+   }
+}
+
+// GT = Parent o (rotation, magnification, reflection)
+static void ComposeGTransform(const GTransform &Parent, double Mag, double Angle, bool Refl,
+                              GTransform *GT)
 {
-   X *= GT.Mag;
-   Y *= (GT.Refl ? -1.0 : 1.0)*GT.Mag;
-  double NewX = GT.X0 + GT.CosTheta*X - GT.SinTheta*Y;
-  double NewY = GT.Y0 + GT.SinTheta*X + GT.CosTheta*Y;
-  *XP = NewX;
-  *YP = NewY;
+  double Cos, Sin;
+  GetCosSin(Angle, &Cos, &Sin);
+  double RMag = (Refl ? -1.0 : 1.0)*Mag;
+  double L11 = Cos*Mag, L12 = -Sin*RMag, L21 = Sin*Mag, L22 = Cos*RMag;
+  GT->A11 = Parent.A11*L11 + Parent.A12*L21;
+  GT->A12 = Parent.A11*L12 + Parent.A12*L22;
+  GT->A21 = Parent.A21*L11 + Parent.A22*L21;
+  GT->A22 = Parent.A21*L12 + Parent.A22*L22;
+  GT->X0  = Parent.X0;
+  GT->Y0  = Parent.Y0;
+  GT->Rigid = Parent.Rigid && Mag==1.0;
 }
 
+// move the origin of the child structure to (X,Y) in the parent's coordinates
+static void SetGTOrigin(const GTransform &Parent, double X, double Y, GTransform *GT)
+{
+  GT->X0 = Parent.X0 + Parent.A11*X + Parent.A12*Y;
+  GT->Y0 = Parent.Y0 + Parent.A21*X + Parent.A22*Y;
+  ClassifyGTransform(GT);
+}
+
+/***************************************************************/
+/* the entities obtained by flattening a structure, with       */
+/* vertices in the structure's own coordinates (in GDSII       */
+/* database units), stored in the order in which they are     */
+/* generated; Vertices[2*Offset...] are the vertices of the    */
+/* entity                                                      */
+/***************************************************************/
+typedef struct CachedEntity
+ { int nl;            // index into Data->Layers
+   int NXY;           // number of vertices
+   size_t Offset;
+   bool Closed;
+   bool WidePath;     // polygon outlining a path of nonzero width
+   const char *Text;  // owned by the GDSIIElement
+   EntitySource Source;
+ } CachedEntity;
+
+typedef struct CellCache
+ { vector<CachedEntity> Entities;
+   dVec Vertices;
+   bool HasWidePaths; // on any layer; if so, the cache is only valid for rigid transforms, as path widths are not magnified
+ } CellCache;
+
 /***************************************************************/
 /* data structure that keeps track of the status of the GMSH   */
 /* file output process                                         */
 /***************************************************************/
+typedef struct LayerCount
+ { int nl; // index into Data->Layers
+   size_t NumEntities, NumVertices, NumTexts, NumRepetitions;
+ } LayerCount;
+
+typedef vector<LayerCount> LayerCounts;
+
+// the next free slots for entities, vertices, text strings and repetitions in a FlatEntityList
+typedef struct Cursor
+ { size_t Entity, Vertex, Text, Repetition;
+ } Cursor;
+
+// number of instances of the referenced structure placed by an SREF or AREF
+static size_t GetNumInstances(GDSIIElement *e)
+{ if (e->Type==SREF) return 1;
+  return (e->Columns>0 && e->Rows>0) ? ((size_t)e->Columns)*e->Rows : 0;
+}
+
+// number of vertices of the entity obtained from a BOUNDARY, PATH or TEXT element
+static int GetNumVertices(GDSIIElement *e)
+{ int NXY = e->XY.size() / 2;
+  if (e->Type==BOUNDARY) return NXY-1;
+  if (e->Type==PATH) return e->Width==0 ? NXY : 2*NXY;
+  return 1;
+}
+
 typedef struct StatusData
-{ int CurrentLayer;
-  double IJ2XY; // scale factor converting GDSII integer-value vertex indices to real-valued coordinates in the chosen length units
-  EntityList EntitiesThisLayer;
-  GTVec GTStack;
+{ double IJ2XY; // scale factor converting GDSII integer-value vertex indices to real-valued coordinates in the chosen length units
+  FlatEntityTable *Table; // (*Table)[nl] receives the entities on layer Data->Layers[nl]
+  vector<Cursor> Next; // the next entity on layer Data->Layers[nl] is stored in the slots Next[nl] of (*Table)[nl]
+  const vector<LayerCounts> *Counts; // entities per layer in each flattened instance of each structure
+  size_t MinTaskSize; // if nonzero, hand reference instances with at least this many entities to other threads
+  int MinLayer;       // LayerIndex[Layer-MinLayer] = index of Layer in Data->Layers, or -1
+  iVec LayerIndex;
+  GTVec GTStack;      // GTStack[n] = composition of the transforms of the first n references on the current path from the top
   int RefDepth;
+  vector<double> PathXY; // scratch space for AddPath
+  CellCache *Cache;   // if nonzero, entities are stored here instead of in Table
+  const vector<CellCache *> *Caches; // Caches[ns], if nonzero, is the flattened content of structure ns
+  FlatEntityTable *AppendTable; // if nonzero, entities are appended to (*AppendTable)[nl] instead of stored in Table
+  const BoundingBox *Window; // if nonzero, only content intersecting this rectangle is flattened
+  int MaxDepth;       // if nonnegative, references nested more than MaxDepth levels deep are replaced by placeholders
+  const vector< vector<LayerExtent> > *Extents; // Data->StructExtents, if Window is nonzero or MaxDepth nonnegative
+  bool CompactArrays; // flatten AREFs as their first instance and a Repetition
+  bool Integer;       // store vertex coordinates in database units as integers, in IXY (unless Cache is nonzero)
 } StatusData;
 
-static void InitStatusData(StatusData *SD, double CoordinateLengthUnit, double PixelLengthUnit)
-{ SD->CurrentLayer=-1;
+// number of copies of the entities of the referenced structure that are
+// stored for an SREF or AREF: one per instance, or one per AREF if
+// arrays are compact
+static size_t GetNumCopies(StatusData *SD, GDSIIElement *e)
+{ size_t NumInstances = GetNumInstances(e);
+  return (SD->CompactArrays && NumInstances>1) ? 1 : NumInstances;
+}
+
+// if LayerMask is nonzero, only layers Data->Layers[nl] with (*LayerMask)[nl] set are flattened
+static void InitStatusData(StatusData *SD, GDSIIData *Data, double CoordinateLengthUnit, double PixelLengthUnit,
+                           const bVec *LayerMask=0)
+{ SD->Table=0;
+  SD->Counts=0;
+  SD->MinTaskSize=0;
+  SD->Cache=0;
+  SD->Caches=0;
+  SD->AppendTable=0;
+  SD->Window=0;
+  SD->MaxDepth=-1;
+  SD->Extents=0;
+  SD->CompactArrays=false;
+  SD->Integer=false;
   SD->IJ2XY = PixelLengthUnit / CoordinateLengthUnit;
   SD->RefDepth=0;
+
+  GTransform Identity = {1.0, 0.0, 0.0, 1.0, 0.0, 0.0, GT_IDENTITY, true};
+  SD->GTStack.assign(1, Identity);
+
+  iVec &Layers = Data->Layers;
+  SD->MinLayer = Layers.size()>0 ? Layers[0] : 0;
+  SD->LayerIndex.assign( Layers.size()>0 ? Layers.back() - Layers[0] + 1 : 0, -1 );
+  for(size_t nl=0; nl<Layers.size(); nl++)
+   if (!LayerMask || (*LayerMask)[nl])
+    SD->LayerIndex[Layers[nl] - SD->MinLayer] = nl;
+}
+
+static int GetLayerIndex(StatusData *SD, int Layer)
+{ 
+  size_t n = Layer - SD->MinLayer;
+  return n < SD->LayerIndex.size() ? SD->LayerIndex[n] : -1;
+}
+
+// the array of vertex coordinates of type T in a FlatEntityList
+static dVec &GetVertexArray(FlatEntityList &List, const double *)
+{ return List.XY; }
+static vector<long long> &GetVertexArray(FlatEntityList &List, const long long *)
+{ return List.IXY; }
+
+// store a new entity with NXY vertices on layer Data->Layers[nl] in
+// the table, returning the array that is to receive its vertex
+// coordinates (in XY if T is double, in IXY if T is long long)
+template<typename T>
+static T *NewTableEntity(StatusData *SD, int nl, int NXY, bool Closed,
+                         const char *Text, const EntitySource &Source, bool Placeholder)
+{
+  unsigned char Flags =   (Closed ? ENTITY_CLOSED : 0) | (Text ? ENTITY_TEXT : 0)
+                        | (Placeholder ? ENTITY_PLACEHOLDER : 0);
+  if (SD->AppendTable)
+   { FlatEntityList &List = (*SD->AppendTable)[nl];
+     if (List.Offsets.size()==0) List.Offsets.push_back(0);
+     size_t ne = List.size(), nv = List.Offsets.back();
+     List.Offsets.push_back(nv + NXY);
+     List.Flags.push_back(Flags);
+     List.Sources.push_back(Source);
+     if (Text)
+      { List.Texts.push_back(Text);
+        List.TextEntities.push_back(ne);
+      }
+     vector<T> &XY = GetVertexArray(List, (T *)0);
+     XY.resize(2*(nv + NXY));
+     return &(XY[2*nv]);
+   }
+
+  FlatEntityList &List = (*SD->Table)[nl];
+  Cursor &Next = SD->Next[nl];
+  size_t ne = Next.Entity++;
+  List.Offsets[ne] = Next.Vertex;
+  List.Flags[ne]   = Flags;
+  List.Sources[ne] = Source;
+  if (Text)
+   { List.Texts[Next.Text]        = Text;
+     List.TextEntities[Next.Text] = ne;
+     Next.Text++;
+   }
+  T *XY = &(GetVertexArray(List, (T *)0)[2*Next.Vertex]);
+  Next.Vertex += NXY;
+  return XY;
+}
+
+// store a new entity with NXY vertices on layer Data->Layers[nl],
+// in the cache or (with floating-point coordinates) in the table,
+// returning the array that is to receive its vertex coordinates
+static double *NewEntity(StatusData *SD, int nl, int NXY, bool Closed, bool WidePath,
+                         const char *Text, const EntitySource &Source, bool Placeholder=false)
+{
+  if (SD->Cache)
+   { CellCache *C = SD->Cache;
+     CachedEntity CE;
+     CE.nl       = nl;
+     CE.NXY      = NXY;
+     CE.Offset   = C->Vertices.size();
+     CE.Closed   = Closed;
+     CE.WidePath = WidePath;
+     CE.Text     = Text;
+     CE.Source   = Source;
+     C->Entities.push_back(CE);
+     C->Vertices.resize(CE.Offset + 2*NXY);
+     return &(C->Vertices[CE.Offset]);
+   }
+  return NewTableEntity<double>(SD, nl, NXY, Closed, Text, Source, Placeholder);
+}
+
+// true if entities are to be stored with integer coordinates
+static bool IntegerOutput(StatusData *SD)
+{ return SD->Integer && !SD->Cache; }
+
+// store a coordinate computed in floating point, rounding it to
+// the nearest integer in integer mode
+static inline void SetCoordinate(double *C, double Value)
+{ *C = Value; }
+static inline void SetCoordinate(long long *C, double Value)
+{ *C = llround(Value); }
+
+// store a repetition of the next NumEntities entities on layer Data->Layers[nl]
+static void NewRepetition(StatusData *SD, int nl, size_t NumEntities, const Repetition &R)
+{
+  FlatEntityList &List = (*SD->Table)[nl];
+  Cursor &Next = SD->Next[nl];
+  Repetition &NewR = List.Repetitions[Next.Repetition++];
+  NewR = R;
+  NewR.First = Next.Entity;
+  NewR.Last  = Next.Entity + NumEntities;
+}
+
+// skip the slots of NumInstances instances of a structure with the given counts
+static void SkipEntities(StatusData *SD, const LayerCounts &Counts, size_t NumInstances)
+{ for(size_t n=0; n<Counts.size(); n++)
+   { Cursor &Next = SD->Next[Counts[n].nl];
+     Next.Entity     += NumInstances*Counts[n].NumEntities;
+     Next.Vertex     += NumInstances*Counts[n].NumVertices;
+     Next.Text       += NumInstances*Counts[n].NumTexts;
+     Next.Repetition += NumInstances*Counts[n].NumRepetitions;
+   }
+}
+
+/***************************************************************/
+/* compute physical coordinates XY[0..2*NXY-1] of the first    */
+/* NXY vertices in IXY, using the innermost composed transform */
+/***************************************************************/
+template<typename T>
+static void GetPhysicalXY(StatusData *SD, const T *IXY, int NXY, double *XY)
+{
+  const GTransform &GT = SD->GTStack.back();
+  double IJ2XY = SD->IJ2XY;
+  double A11=GT.A11, A12=GT.A12, A21=GT.A21, A22=GT.A22, X0=GT.X0, Y0=GT.Y0;
+  switch(GT.Class)
+   { case GT_IDENTITY:
+      for(int n=0; n<NXY; n++)
+       { XY[2*n+0] = IJ2XY * IXY[2*n+0];
+         XY[2*n+1] = IJ2XY * IXY[2*n+1];
+       }
+      break;
+
+     case GT_TRANSLATE:
+      for(int n=0; n<NXY; n++)
+       { XY[2*n+0] = IJ2XY * (X0 + IXY[2*n+0]);
+         XY[2*n+1] = IJ2XY * (Y0 + IXY[2*n+1]);
+       }
+      break;
+
+     case GT_SCALE:
+      for(int n=0; n<NXY; n++)
+       { XY[2*n+0] = IJ2XY * (X0 + A11*IXY[2*n+0]);
+         XY[2*n+1] = IJ2XY * (Y0 + A22*IXY[2*n+1]);
+       }
+      break;
+
+     case GT_ROT90:
+      for(int n=0; n<NXY; n++)
+       { XY[2*n+0] = IJ2XY * (X0 + A12*IXY[2*n+1]);
+         XY[2*n+1] = IJ2XY * (Y0 + A21*IXY[2*n+0]);
+       }
+      break;
+
+     default:
+      for(int n=0; n<NXY; n++)
+       { double X=IXY[2*n+0], Y=IXY[2*n+1];
+         XY[2*n+0] = IJ2XY * (X0 + A11*X + A12*Y);
+         XY[2*n+1] = IJ2XY * (Y0 + A21*X + A22*Y);
+       }
+   }
+}
+
+/***************************************************************/
+/* integer mode: as above, but with integer coordinates in     */
+/* database units (SD->IJ2XY is 1). If the vertices IXY are    */
+/* integers and the transform has integer matrix entries and   */
+/* offsets (e.g. a translation by integers, possibly combined  */
+/* with a rotation by a multiple of 90 degrees or a            */
+/* reflection, but not with a fractional magnification), the   */
+/* results are computed in integer arithmetic; otherwise they  */
+/* are rounded to the nearest integer.                         */
+/***************************************************************/
+template<typename T>
+static void GetPhysicalXY(StatusData *SD, const T *IXY, int NXY, long long *XY)
+{
+  const GTransform &GT = SD->GTStack.back();
+  bool Exact =    numeric_limits<T>::is_integer && SD->IJ2XY==1.0
+               && GT.A11==floor(GT.A11) && GT.A12==floor(GT.A12)
+               && GT.A21==floor(GT.A21) && GT.A22==floor(GT.A22)
+               && GT.X0==floor(GT.X0)   && GT.Y0==floor(GT.Y0);
+  if (!Exact)
+   { double IJ2XY = SD->IJ2XY;
+     double A11=GT.A11, A12=GT.A12, A21=GT.A21, A22=GT.A22, X0=GT.X0, Y0=GT.Y0;
+     for(int n=0; n<NXY; n++)
+      { double X=IXY[2*n+0], Y=IXY[2*n+1];
+        XY[2*n+0] = llround(IJ2XY * (X0 + A11*X + A12*Y));
+        XY[2*n+1] = llround(IJ2XY * (Y0 + A21*X + A22*Y));
+      }
+     return;
+   }
+
+  long long A11=GT.A11, A12=GT.A12, A21=GT.A21, A22=GT.A22, X0=GT.X0, Y0=GT.Y0;
+  switch(GT.Class)
+   { case GT_IDENTITY:
+      for(int n=0; n<2*NXY; n++)
+       XY[n] = IXY[n];
+      break;
+
+     case GT_TRANSLATE:
+      for(int n=0; n<NXY; n++)
+       { XY[2*n+0] = X0 + IXY[2*n+0];
+         XY[2*n+1] = Y0 + IXY[2*n+1];
+       }
+      break;
+
+     case GT_SCALE:
+      for(int n=0; n<NXY; n++)
+       { XY[2*n+0] = X0 + A11*IXY[2*n+0];
+         XY[2*n+1] = Y0 + A22*IXY[2*n+1];
+       }
+      break;
+
+     case GT_ROT90:
+      for(int n=0; n<NXY; n++)
+       { XY[2*n+0] = X0 + A12*IXY[2*n+1];
+         XY[2*n+1] = Y0 + A21*IXY[2*n+0];
+       }
+      break;
+
+     default:
+      for(int n=0; n<NXY; n++)
+       { XY[2*n+0] = X0 + A11*IXY[2*n+0] + A12*IXY[2*n+1];
+         XY[2*n+1] = Y0 + A21*IXY[2*n+0] + A22*IXY[2*n+1];
+       }
+   }
+}
+
+/***************************************************************/
+/* store a new entity whose NXY vertices are the images of the */
+/* vertices IXY under the innermost composed transform, in the */
+/* order given or, if Reverse, in reverse order                */
+/***************************************************************/
+template<typename T>
+static void ReverseVertices(T *XY, int NXY)
+{ for(int m=0, mm=NXY-1; m<mm; m++, mm--)
+   { std::swap(XY[2*m+0], XY[2*mm+0]);
+     std::swap(XY[2*m+1], XY[2*mm+1]);
+   }
 }
 
-//FIXME 
-static void GetPhysicalXY(StatusData *SD, double X, double Y, double *pXP, double *pYP)
+template<typename T>
+static void AddTransformedEntity(StatusData *SD, int nl, const T *IXY, int NXY, bool Closed,
+                                 bool WidePath, const char *Text, const EntitySource &Source,
+                                 bool Reverse=false)
 {
-  double XP=X, YP=Y;
-  for(unsigned n=SD->GTStack.size(); n>0; n--)
-   { ApplyGTransform(SD->GTStack[n-1],X,Y,&XP,&YP);
-     X=XP;
-     Y=YP;
+  if (IntegerOutput(SD))
+   { long long *XY = NewTableEntity<long long>(SD, nl, NXY, Closed, Text, Source, false);
+     GetPhysicalXY(SD, IXY, NXY, XY);
+     if (Reverse) ReverseVertices(XY, NXY);
+   }
+  else
+   { double *XY = NewEntity(SD, nl, NXY, Closed, WidePath, Text, Source);
+     GetPhysicalXY(SD, IXY, NXY, XY);
+     if (Reverse) ReverseVertices(XY, NXY);
    }
-  *pXP = SD->IJ2XY * XP;
-  *pYP = SD->IJ2XY * YP;
+}
+
+/***************************************************************/
+/* bounding boxes, used to restrict flattening to a window     */
+/***************************************************************/
+static void GrowBox(BoundingBox *B, double X, double Y)
+{ if (X<B->XMin) B->XMin=X;
+  if (X>B->XMax) B->XMax=X;
+  if (Y<B->YMin) B->YMin=Y;
+  if (Y>B->YMax) B->YMax=Y;
+}
+
+static void GrowBox(BoundingBox *B, const BoundingBox &B2)
+{ GrowBox(B, B2.XMin, B2.YMin);
+  GrowBox(B, B2.XMax, B2.YMax);
+}
+
+// bounding box of the image of box B under transform GT, scaled by Scale
+static BoundingBox TransformBox(const GTransform &GT, double Scale, const BoundingBox &B)
+{
+  BoundingBox TB={HUGE_VAL, HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  double X[2]={B.XMin, B.XMax}, Y[2]={B.YMin, B.YMax};
+  for(int i=0; i<2; i++)
+   for(int j=0; j<2; j++)
+    GrowBox(&TB, Scale*(GT.X0 + GT.A11*X[i] + GT.A12*Y[j]),
+                 Scale*(GT.Y0 + GT.A21*X[i] + GT.A22*Y[j]));
+  return TB;
+}
+
+static bool Overlap(const BoundingBox &B1, const BoundingBox &B2)
+{ return B1.XMin<=B2.XMax && B2.XMin<=B1.XMax && B1.YMin<=B2.YMax && B2.YMin<=B1.YMax; }
+
+/***************************************************************/
+/* grow LayerExtents[nl] (for each layer index nl) by the      */
+/* extents RefExtents of the structure placed by SREF or AREF  */
+/* e, in the coordinates of the parent structure given by      */
+/* transform Parent and scaled by Scale. The extents of an     */
+/* AREF are those of its corner instances.                     */
+/***************************************************************/
+static void GrowRefExtents(const GTransform &Parent, double Scale, GDSIIElement *e,
+                           const vector<LayerExtent> &RefExtents,
+                           vector<LayerExtent> &LayerExtents)
+{
+  GTransform GT;
+  if (e->Type==SREF)
+   ComposeGTransform(Parent, e->Mag, e->Angle, e->Refl, &GT);
+  else
+   ComposeGTransform(Parent, 1.0, 0.0, false, &GT);
+  int NC=1, NR=1;
+  double DeltaXYC[2]={0,0}, DeltaXYR[2]={0,0};
+  if (e->Type==AREF)
+   { NC = e->Columns;
+     NR = e->Rows;
+     DeltaXYC[0] = ((double)e->XY[2] - e->XY[0]) / NC;
+     DeltaXYC[1] = ((double)e->XY[3] - e->XY[1]) / NC;
+     DeltaXYR[0] = ((double)e->XY[4] - e->XY[0]) / NR;
+     DeltaXYR[1] = ((double)e->XY[5] - e->XY[1]) / NR;
+   }
+  for(int nc=0; nc<NC; nc+=(NC>1 ? NC-1 : 1))
+   for(int nr=0; nr<NR; nr+=(NR>1 ? NR-1 : 1))
+    { SetGTOrigin(Parent, e->XY[0] + nc*DeltaXYC[0] + nr*DeltaXYR[0],
+                          e->XY[1] + nc*DeltaXYC[1] + nr*DeltaXYR[1], &GT);
+      for(size_t n=0; n<RefExtents.size(); n++)
+       { const LayerExtent &RefLE = RefExtents[n];
+         LayerExtent *LE = &(LayerExtents[RefLE.nl]);
+         GrowBox(&(LE->Box), TransformBox(GT, Scale, RefLE.Box));
+         LE->HalfWidth = fmax(LE->HalfWidth, RefLE.HalfWidth);
+       }
+    }
+}
+
+/***************************************************************/
+/* compute Extents[ns] from the extents of the structures that */
+/* structure ns references; Status[ns] is as in CountEntities()*/
+/***************************************************************/
+static void GetStructExtents(StatusData *SD, GDSIIData *Data, int ns,
+                             vector< vector<LayerExtent> > &Extents, vector<char> &Status)
+{
+  if (Status[ns]!=0) return;
+  Status[ns]=1;
+
+  GDSIIStruct *s=Data->Structs[ns];
+  BoundingBox Empty={HUGE_VAL, HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  vector<LayerExtent> LayerExtents(Data->Layers.size());
+  for(size_t nl=0; nl<LayerExtents.size(); nl++)
+   { LayerExtents[nl].nl        = nl;
+     LayerExtents[nl].Box       = Empty;
+     LayerExtents[nl].HalfWidth = -1.0; // no content on this layer
+   }
+
+  GTransform Identity = {1.0, 0.0, 0.0, 1.0, 0.0, 0.0, GT_IDENTITY, true};
+  for(size_t ne=0; ne<s->Elements.size() && !s->IsPCell; ne++)
+   { GDSIIElement *e=s->Elements[ne];
+     if (e->Type==BOUNDARY || e->Type==PATH || e->Type==TEXT)
+      { int nl = GetLayerIndex(SD, e->Layer);
+        if (nl==-1) continue;
+        LayerExtent *LE = &(LayerExtents[nl]);
+        for(size_t n=0; n+1<e->XY.size(); n+=2)
+         GrowBox(&(LE->Box), e->XY[n], e->XY[n+1]);
+        LE->HalfWidth = fmax(LE->HalfWidth, e->Type==PATH ? 0.5*fabs((double)e->Width) : 0.0);
+      }
+     else if (e->Type==SREF || e->Type==AREF)
+      { int nsRef = e->nsRef;
+        if ( nsRef<0 || nsRef>=((int)(Data->Structs.size())) || GetNumInstances(e)==0 )
+         continue;
+        GetStructExtents(SD, Data, nsRef, Extents, Status);
+        GrowRefExtents(Identity, 1.0, e, Extents[nsRef], LayerExtents);
+      }
+   }
+
+  for(size_t nl=0; nl<LayerExtents.size(); nl++)
+   if (LayerExtents[nl].HalfWidth>=0.0)
+    Extents[ns].push_back(LayerExtents[nl]);
+  Status[ns]=2;
+}
+
+// true if the content of structure ns on the layers being flattened,
+// placed by transform GT (or by any transform along the line from GT
+// to *GT2, if GT2 is nonzero), intersects the window
+static bool StructInWindow(StatusData *SD, GDSIIData *Data, int ns,
+                           const GTransform &GT, const GTransform *GT2=0)
+{
+  const vector<LayerExtent> &Extents = (*SD->Extents)[ns];
+  for(size_t n=0; n<Extents.size(); n++)
+   { const LayerExtent &LE = Extents[n];
+     if (GetLayerIndex(SD, Data->Layers[LE.nl])==-1) continue;
+     BoundingBox B = TransformBox(GT, SD->IJ2XY, LE.Box);
+     if (GT2) GrowBox(&B, TransformBox(*GT2, SD->IJ2XY, LE.Box));
+     double HW = SD->IJ2XY * LE.HalfWidth;
+     B.XMin-=HW; B.YMin-=HW; B.XMax+=HW; B.YMax+=HW;
+     if (Overlap(B, *SD->Window)) return true;
+   }
+  return false;
+}
+
+// true if the (transformed) bounding box of element e intersects the window
+static bool ElementInWindow(StatusData *SD, GDSIIElement *e)
+{
+  BoundingBox B={HUGE_VAL, HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  for(size_t n=0; n+1<e->XY.size(); n+=2)
+   GrowBox(&B, e->XY[n], e->XY[n+1]);
+  B = TransformBox(SD->GTStack.back(), SD->IJ2XY, B);
+  double HW = (e->Type==PATH ? 0.5*fabs((double)e->Width)*SD->IJ2XY : 0.0);
+  B.XMin-=HW; B.YMin-=HW; B.XMax+=HW; B.YMax+=HW;
+  return Overlap(B, *SD->Window);
+}
+
+/***************************************************************/
+/* Counting pass: the number of entities contributed to each   */
+/* layer by each flattened instance of structure ns (and the   */
+/* numbers of their vertices and text strings), computed once  */
+/* per structure from the counts of the structures it          */
+/* references. Counts[ns] lists the counts on each layer with  */
+/* content, in order of layer index; Status[ns] is 0 for       */
+/* structures not yet visited, 1 while in progress, and 2 once */
+/* done. Order receives the structures visited, each after all */
+/* the structures it references. WidePaths[ns] is set if       */
+/* structure ns or any structure it references contains a path */
+/* of nonzero width on any layer, and Arrays[ns] if any of     */
+/* them contains an AREF of more than one instance.            */
+/***************************************************************/
+static void CountEntities(StatusData *SD, GDSIIData *Data, int ns,
+                          vector<LayerCounts> &Counts, vector<char> &Status, iVec &Order,
+                          bVec &WidePaths, bVec &Arrays)
+{
+  if (Status[ns]!=0) return;
+  Status[ns]=1;
+
+  GDSIIStruct *s=Data->Structs[ns];
+  LayerCounts LC(Data->Layers.size());
+  for(size_t nl=0; nl<LC.size(); nl++)
+   { LC[nl].nl=nl;
+     LC[nl].NumEntities=LC[nl].NumVertices=LC[nl].NumTexts=LC[nl].NumRepetitions=0;
+   }
+  for(size_t ne=0; ne<s->Elements.size() && !s->IsPCell; ne++)
+   { GDSIIElement *e=s->Elements[ne];
+     if (e->Type==BOUNDARY || e->Type==PATH || e->Type==TEXT)
+      { int nl = GetLayerIndex(SD, e->Layer);
+        if (nl!=-1)
+         { LC[nl].NumEntities++;
+           LC[nl].NumVertices += GetNumVertices(e);
+           if (e->Type==TEXT) LC[nl].NumTexts++;
+         }
+        if (e->Type==PATH && e->Width!=0) WidePaths[ns]=true;
+      }
+     else if (e->Type==SREF || e->Type==AREF)
+      { int nsRef = e->nsRef;
+        if ( nsRef<0 || nsRef>=((int)(Data->Structs.size())) )
+         continue; // reported by AddASRef
+        CountEntities(SD, Data, nsRef, Counts, Status, Order, WidePaths, Arrays);
+        if (WidePaths[nsRef]) WidePaths[ns]=true;
+        bool Repeated = GetNumInstances(e)>1 && e->Type==AREF;
+        if (Arrays[nsRef] || Repeated) Arrays[ns]=true;
+        size_t NumCopies = GetNumCopies(SD, e);
+        for(size_t n=0; n<Counts[nsRef].size(); n++)
+         { const LayerCount &RefLC = Counts[nsRef][n];
+           LC[RefLC.nl].NumEntities    += NumCopies*RefLC.NumEntities;
+           LC[RefLC.nl].NumVertices    += NumCopies*RefLC.NumVertices;
+           LC[RefLC.nl].NumTexts       += NumCopies*RefLC.NumTexts;
+           LC[RefLC.nl].NumRepetitions += NumCopies*RefLC.NumRepetitions;
+           if (Repeated && SD->CompactArrays)
+            LC[RefLC.nl].NumRepetitions++;
+         }
+      }
+   }
+
+  for(size_t nl=0; nl<LC.size(); nl++)
+   if (LC[nl].NumEntities>0)
+    Counts[ns].push_back(LC[nl]);
+  Status[ns]=2;
+  Order.push_back(ns);
 }
 
 /***************************************************************/
@@ -94,23 +691,44 @@ void AddBoundary(StatusData *SD, GDSIIData *Data, int ns, int ne)
 {
   GDSIIStruct *s  = Data->Structs[ns];
   GDSIIElement *e = s->Elements[ne];
-  if (SD->CurrentLayer!=e->Layer) return;
+  int nl = GetLayerIndex(SD, e->Layer);
+  if (nl==-1) return;
 
-  vector<int> IXY = e->XY;
-  int NXY         = IXY.size() / 2;
+  XYArray IXY     = e->XY;
+  int NXY         = GetNumVertices(e);
 
-  char Label[1000];
-  snprintf(Label,1000,"Struct %s element #%i (boundary)",s->Name->c_str(),ne);
+  EntitySource Source = {ns, ne};
+  AddTransformedEntity(SD, nl, IXY.Values, NXY, true, false, 0, Source);
+}
 
-  Entity E;
-  E.XY.resize(IXY.size() - 2);
-  E.Text   = 0;
-  E.Label  = strdup(Label);
-  E.Closed = true;
+/***************************************************************/
+/* the outline of a path of width W, with transformed          */
+/* centerline CXY[0..2*NXY-1], as a polygon with 2*NXY vertices */
+/***************************************************************/
+template<typename T>
+static void GetPathOutline(const double *CXY, int NXY, double W, T *XY)
+{
   for(int n=0; n<NXY-1; n++)
-   GetPhysicalXY(SD, IXY[2*n+0], IXY[2*n+1], &(E.XY[2*n]), &(E.XY[2*n+1]));
+   { 
+     double X1 = CXY[2*n+0],     Y1 = CXY[2*n+1];
+     double X2 = CXY[2*(n+1)+0], Y2 = CXY[2*(n+1)+1];
 
-  SD->EntitiesThisLayer.push_back(E);
+     // unit vector in width direction
+     double DX = X2-X1, DY=Y2-Y1, DNorm = sqrt(DX*DX + DY*DY);
+     if (DNorm==0.0) DNorm=1.0;
+     double XHat = +1.0*DY / DNorm;
+     double YHat = -1.0*DX / DNorm;
+
+     SetCoordinate(XY+2*n+0, X1-0.5*W*XHat);  SetCoordinate(XY+2*n+1, Y1-0.5*W*YHat);
+     int nn = 2*NXY-1-n;
+     SetCoordinate(XY+2*nn+0, X1+0.5*W*XHat); SetCoordinate(XY+2*nn+1, Y1+0.5*W*YHat);
+
+     if (n==NXY-2)
+      { nn=NXY-1;
+        SetCoordinate(XY+2*nn+0, X2-0.5*W*XHat);  SetCoordinate(XY+2*nn+1, Y2-0.5*W*YHat);
+        SetCoordinate(XY+2*nn+2, X2+0.5*W*XHat);  SetCoordinate(XY+2*nn+3, Y2+0.5*W*YHat);
+      }
+   }
 }
 
 /***************************************************************/
@@ -120,51 +738,29 @@ void AddPath(StatusData *SD, GDSIIData *Data, int ns, int ne)
 {
   GDSIIStruct *s  = Data->Structs[ns];
   GDSIIElement *e = s->Elements[ne];
+  int nl = GetLayerIndex(SD, e->Layer);
+  if (nl==-1) return;
 
-  if (SD->CurrentLayer!=e->Layer) return;
-  char Label[1000];
-  snprintf(Label,1000,"Struct %s element #%i (path)",s->Name->c_str(),ne);
-
-  vector<int> IXY = e->XY;
+  XYArray IXY     = e->XY;
   int NXY         = IXY.size() / 2;
 
   double IJ2XY    = SD->IJ2XY;
   double W        = e->Width*IJ2XY;
 
-  Entity E;
-  E.Text   = 0;
-  E.Label  = strdup(Label);
-  E.Closed = (W!=0.0);
-  int NumNodes = (W==0.0 ? NXY : 2*NXY);
-  E.XY.resize(2*NumNodes); 
-
+  EntitySource Source = {ns, ne};
   if (W==0.0)
-   for(int n=0; n<NXY; n++)
-    GetPhysicalXY(SD, IXY[2*n+0], IXY[2*n+1], &(E.XY[2*n+0]),&(E.XY[2*n+1]));
+   { AddTransformedEntity(SD, nl, IXY.Values, NXY, false, false, 0, Source);
+     return;
+   }
+
+  vector<double> &CXY = SD->PathXY; // transformed centerline
+  CXY.resize(2*NXY);
+  GetPhysicalXY(SD, IXY.Values, NXY, CXY.data());
+  int NumNodes = GetNumVertices(e);
+  if (IntegerOutput(SD))
+   GetPathOutline(CXY.data(), NXY, W, NewTableEntity<long long>(SD, nl, NumNodes, true, 0, Source, false));
   else
-   for(int n=0; n<NXY-1; n++)
-    { 
-      double X1, Y1, X2, Y2;
-      GetPhysicalXY(SD, IXY[2*n+0],      IXY[2*n+1],     &X1, &Y1);
-      GetPhysicalXY(SD, IXY[2*(n+1)+0],  IXY[2*(n+1)+1], &X2, &Y2);
-
-      // unit vector in width direction
-      double DX = X2-X1, DY=Y2-Y1, DNorm = sqrt(DX*DX + DY*DY);
-      if (DNorm==0.0) DNorm=1.0;
-      double XHat = +1.0*DY / DNorm;
-      double YHat = -1.0*DX / DNorm;
-
-      E.XY[2*n+0]  = X1-0.5*W*XHat;  E.XY[2*n+1]  = Y1-0.5*W*YHat;
-      int nn = 2*NXY-1-n;
-      E.XY[2*nn+0] = X1+0.5*W*XHat;  E.XY[2*nn+1] = Y1+0.5*W*YHat;
-
-      if (n==NXY-2)
-       { nn=NXY-1;
-         E.XY[2*nn+0] = X2-0.5*W*XHat;  E.XY[2*nn+1] = Y2-0.5*W*YHat;
-         E.XY[2*nn+2] = X2+0.5*W*XHat;  E.XY[2*nn+3] = Y2+0.5*W*YHat;
-       }
-    }
-  SD->EntitiesThisLayer.push_back(E);
+   GetPathOutline(CXY.data(), NXY, W, NewEntity(SD, nl, NumNodes, true, true, 0, Source));
 }
 
 /***************************************************************/
@@ -174,50 +770,112 @@ void AddText(StatusData *SD, GDSIIData *Data, int ns, int ne)
 {  
   GDSIIStruct *s  = Data->Structs[ns];
   GDSIIElement *e = s->Elements[ne];
-  if (SD->CurrentLayer!=e->Layer) return;
-
-  char Label[1000];
-  snprintf(Label,1000,"Struct %s element #%i (texttype %i)",s->Name->c_str(),ne,e->TextType);
+  int nl = GetLayerIndex(SD, e->Layer);
+  if (nl==-1) return;
 
-  vector<int> IXY  = e->XY;
-    
-  double X, Y;
-  GetPhysicalXY(SD, IXY[0], IXY[1], &X, &Y);
+  XYArray IXY      = e->XY;
+  EntitySource Source = {ns, ne};
+  AddTransformedEntity(SD, nl, IXY.Values, 1, false, false, e->Text->c_str(), Source);
+}
 
-  Entity E;
-  E.XY.push_back(X);
-  E.XY.push_back(Y);
-  E.Text   = strdup(e->Text->c_str());
-  E.Label  = strdup(Label);
-  E.Closed = false;
-  SD->EntitiesThisLayer.push_back(E);
+/***************************************************************/
+/* add an instance of a structure whose flattened content has  */
+/* been cached, transforming each cached entity by the         */
+/* innermost composed transform. Under a reflection, the two   */
+/* sides of a wide path trade places, so the polygon's         */
+/* vertices are reversed to match the order in which AddPath   */
+/* would have generated them.                                  */
+/***************************************************************/
+static void AddCachedStruct(StatusData *SD, const CellCache *C)
+{
+  const GTransform &GT = SD->GTStack.back();
+  bool Reflected = (GT.A11*GT.A22 - GT.A12*GT.A21) < 0.0;
+  for(size_t n=0; n<C->Entities.size(); n++)
+   { const CachedEntity &CE = C->Entities[n];
+     AddTransformedEntity(SD, CE.nl, &(C->Vertices[CE.Offset]), CE.NXY, CE.Closed, CE.WidePath,
+                          CE.Text, CE.Source, CE.WidePath && Reflected);
+   }
 }
 
 void AddStruct(StatusData *SD, GDSIIData *Data, int ns, bool ASRef=false);
 
-void AddASRef(StatusData *SD, GDSIIData *Data, int ns, int ne)
+// flatten NR instances of structure nsRef, the first with its origin at
+// (X0,Y0) and each subsequent one displaced by DeltaXYR, in the
+// coordinates of the structure at the top of the transform stack
+static void AddColumn(StatusData *SD, GDSIIData *Data, int nsRef, int NR,
+                      double X0, double Y0, const double DeltaXYR[2])
 {
-  SD->RefDepth++;
+  int CurrentGT = SD->GTStack.size()-1;
+  for(int nr=0; nr<NR; nr++)
+   { SetGTOrigin(SD->GTStack[CurrentGT-1], X0 + nr*DeltaXYR[0], Y0 + nr*DeltaXYR[1],
+                 &(SD->GTStack[CurrentGT]));
+     if (SD->Window && NR>1 && !StructInWindow(SD, Data, nsRef, SD->GTStack[CurrentGT]))
+      continue;
+     AddStruct(SD, Data, nsRef, true);
+   }
+}
 
+/***************************************************************/
+/* add, in place of the instances placed by an SREF or AREF    */
+/* below the depth limit, a rectangle outlining their bounding */
+/* box on each layer on which they have content                */
+/***************************************************************/
+static void AddPlaceholder(StatusData *SD, GDSIIData *Data, int ns, int ne)
+{
+  GDSIIElement *e = Data->Structs[ns]->Elements[ne];
+  if (GetNumInstances(e)==0) return;
+
+  BoundingBox Empty={HUGE_VAL, HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  LayerExtent None = {0, Empty, -1.0};
+  vector<LayerExtent> LayerExtents(Data->Layers.size(), None);
+  GrowRefExtents(SD->GTStack.back(), SD->IJ2XY, e, (*SD->Extents)[e->nsRef], LayerExtents);
+
+  EntitySource Source = {ns, ne};
+  for(size_t nl=0; nl<LayerExtents.size(); nl++)
+   { if (LayerExtents[nl].HalfWidth<0.0 || GetLayerIndex(SD, Data->Layers[nl])==-1) continue;
+     BoundingBox B = LayerExtents[nl].Box;
+     double HW = SD->IJ2XY * LayerExtents[nl].HalfWidth;
+     double Corners[8] = { B.XMin-HW, B.YMin-HW,  B.XMax+HW, B.YMin-HW,
+                           B.XMax+HW, B.YMax+HW,  B.XMin-HW, B.YMax+HW };
+     if (IntegerOutput(SD))
+      { long long *XY = NewTableEntity<long long>(SD, nl, 4, true, 0, Source, true);
+        for(int n=0; n<8; n++) SetCoordinate(XY+n, Corners[n]);
+      }
+     else
+      { double *XY = NewEntity(SD, nl, 4, true, false, 0, Source, true);
+        for(int n=0; n<8; n++) XY[n] = Corners[n];
+      }
+   }
+}
+
+void AddASRef(StatusData *SD, GDSIIData *Data, int ns, int ne)
+{
   GDSIIStruct *s   = Data->Structs[ns];
   GDSIIElement *e  = s->Elements[ne];
-  vector<int> IXY  = e->XY;
+  XYArray IXY      = e->XY;
 
+  // if only a single structure was read, the structures
+  // it references are absent and are simply left out
   int nsRef = e->nsRef;
+  if ( nsRef==-1 && !Data->ReadOptions.StructName.empty() )
+   return;
   if ( nsRef==-1 || nsRef>=((int)(Data->Structs.size())) )
    GDSIIData::ErrExit("structure %i (%s), element %i: REF to unknown structure %s",ns,s->Name,ne,e->SName);
+
+  if (SD->MaxDepth>=0 && SD->RefDepth>=SD->MaxDepth)
+   { AddPlaceholder(SD, Data, ns, ne);
+     return;
+   }
+
+  SD->RefDepth++;
     
   double Mag   = (e->Type==SREF) ? e->Mag   : 1.0;
   double Angle = (e->Type==SREF) ? e->Angle : 0.0;
   bool   Refl  = (e->Type==SREF) ? e->Refl  : false;
 
   GTransform GT;
-  GT.CosTheta=cos(Angle*M_PI/180.0);
-  GT.SinTheta=sin(Angle*M_PI/180.0);
-  GT.Mag=Mag;
-  GT.Refl=Refl;
+  ComposeGTransform(SD->GTStack.back(), Mag, Angle, Refl, &GT);
   SD->GTStack.push_back(GT);
-  int CurrentGT = SD->GTStack.size()-1;
 
   int NC=1, NR=1;
   double XYCenter[2], DeltaXYC[2]={0,0}, DeltaXYR[2]={0,0};
@@ -233,13 +891,64 @@ void AddASRef(StatusData *SD, GDSIIData *Data, int ns, int ne)
      DeltaXYR[1] = ((double)IXY[5] - XYCenter[1]) / NR;
    }
 
+  // a compact array is flattened as its first instance, preceded on
+  // each layer by a repetition of the entities of that instance
+  if (SD->CompactArrays && e->Type==AREF && GetNumInstances(e)>1)
+   { Repetition R;
+     double IJ2XY = SD->IJ2XY;
+     R.Columns     = NC;
+     R.Rows        = NR;
+     R.ColumnXY[0] = IJ2XY*(GT.A11*DeltaXYC[0] + GT.A12*DeltaXYC[1]);
+     R.ColumnXY[1] = IJ2XY*(GT.A21*DeltaXYC[0] + GT.A22*DeltaXYC[1]);
+     R.RowXY[0]    = IJ2XY*(GT.A11*DeltaXYR[0] + GT.A12*DeltaXYR[1]);
+     R.RowXY[1]    = IJ2XY*(GT.A21*DeltaXYR[0] + GT.A22*DeltaXYR[1]);
+     const LayerCounts &Counts = (*SD->Counts)[nsRef];
+     for(size_t n=0; n<Counts.size(); n++)
+      NewRepetition(SD, Counts[n].nl, Counts[n].NumEntities, R);
+     NC=NR=1;
+   }
+
+  // in a parallel flatten, each column of instances large enough
+  // to be worth it becomes a task that flattens into its own
+  // StatusData (a copy of the current one) and fills the slots
+  // that the serial traversal would have filled; the current
+  // thread skips over these slots
+  bool Spawn=false;
+  if (SD->MinTaskSize>0 && NR>0)
+   { size_t NumEntities=0;
+     const LayerCounts &Counts = (*SD->Counts)[nsRef];
+     for(size_t n=0; n<Counts.size(); n++)
+      NumEntities += Counts[n].NumEntities;
+     Spawn = (NR*NumEntities >= SD->MinTaskSize);
+   }
+
   for(int nc=0; nc<NC; nc++)
-   for(int nr=0; nr<NR; nr++)
-    { 
-      SD->GTStack[CurrentGT].X0 = XYCenter[0] + nc*DeltaXYC[0] + nr*DeltaXYR[0];
-      SD->GTStack[CurrentGT].Y0 = XYCenter[1] + nc*DeltaXYC[1] + nr*DeltaXYR[1];
-      AddStruct(SD, Data, nsRef, true);
-    }
+   { 
+     // skip columns that lie entirely outside the window
+     if (SD->Window && NR>0)
+      { const GTransform &Parent = SD->GTStack[SD->GTStack.size()-2];
+        GTransform First=GT, Last=GT;
+        SetGTOrigin(Parent, XYCenter[0] + nc*DeltaXYC[0], XYCenter[1] + nc*DeltaXYC[1], &First);
+        SetGTOrigin(Parent, XYCenter[0] + nc*DeltaXYC[0] + (NR-1)*DeltaXYR[0],
+                            XYCenter[1] + nc*DeltaXYC[1] + (NR-1)*DeltaXYR[1], &Last);
+        if (!StructInWindow(SD, Data, nsRef, First, &Last))
+         continue;
+      }
+
+     if (!Spawn)
+      { AddColumn(SD, Data, nsRef, NR, XYCenter[0] + nc*DeltaXYC[0], XYCenter[1] + nc*DeltaXYC[1], DeltaXYR);
+        continue;
+      }
+     StatusData *ColumnSD = new StatusData(*SD);
+     SkipEntities(SD, (*SD->Counts)[nsRef], NR);
+     double X0C = XYCenter[0] + nc*DeltaXYC[0], Y0C = XYCenter[1] + nc*DeltaXYC[1];
+     double DXR = DeltaXYR[0], DYR = DeltaXYR[1];
+#pragma omp task firstprivate(ColumnSD, Data, nsRef, NR, X0C, Y0C, DXR, DYR)
+     { double DeltaXYRC[2] = {DXR, DYR};
+       AddColumn(ColumnSD, Data, nsRef, NR, X0C, Y0C, DeltaXYRC);
+       delete ColumnSD;
+     }
+   }
 
   SD->GTStack.pop_back();
   SD->RefDepth--;
@@ -253,6 +962,10 @@ void AddElement(StatusData *SD, GDSIIData *Data, int ns, int ne)
   GDSIIStruct *s  = Data->Structs[ns];
   GDSIIElement *e = s->Elements[ne];
 
+  if (    SD->Window && (e->Type==BOUNDARY || e->Type==PATH || e->Type==TEXT)
+       && GetLayerIndex(SD, e->Layer)!=-1 && !ElementInWindow(SD, e) )
+   return;
+
   switch(e->Type)
    { 
      /*--------------------------------------------------------------*/
@@ -289,13 +1002,158 @@ void AddStruct(StatusData *SD, GDSIIData *Data, int ns, bool ASRef)
 
   if (s->IsPCell) return;
   if (ASRef==false && s->IsReferenced) return;
+
+  // skip structures with nothing on the layers being flattened
+  if (ASRef && SD->Counts && (*SD->Counts)[ns].size()==0) return;
+
+  const CellCache *C = (ASRef && SD->Caches) ? (*SD->Caches)[ns] : 0;
+  if (C && (SD->GTStack.back().Rigid || !C->HasWidePaths))
+   { AddCachedStruct(SD, C);
+     return;
+   }
   
   for(size_t ne=0; ne<s->Elements.size(); ne++)
    AddElement(SD, Data, ns, ne);
 }
 
 /***************************************************************/
+/* Flatten the top-level structures among TopStructs into      */
+/* Table, following the entities already present on each       */
+/* layer. A counting pass (which also fills in Counts) sizes   */
+/* each layer's list, after which a single traversal stores    */
+/* each entity in its slot. Structures instantiated more than  */
+/* once are flattened once into a cache in their own           */
+/* coordinates, so that each instance costs only a transform   */
+/* of the cached vertices. With more than one thread, large    */
+/* reference instances are flattened as OpenMP tasks; since    */
+/* every instance fills the slots the serial traversal would   */
+/* have filled, the result does not depend on the number of    */
+/* threads or on how the tasks are scheduled. If DBUnits is    */
+/* set, vertex coordinates are stored as integers in database  */
+/* units (in IXY).                                             */
 /***************************************************************/
+static void FlattenStructs(GDSIIData *Data, const iVec &TopStructs, FlatEntityTable *Table,
+                           vector<LayerCounts> &Counts, int NumThreads, const bVec *LayerMask,
+                           bool DBUnits=false)
+{
+  StatusData SD;
+  if (DBUnits)
+   { InitStatusData(&SD, Data, 1.0, 1.0, LayerMask);
+     SD.Integer = true;
+   }
+  else
+   { InitStatusData(&SD, Data, Data->LengthUnit, Data->FileUnits[1], LayerMask);
+     SD.CompactArrays = Data->ReadOptions.CompactArrays;
+   }
+
+  size_t NumStructs = Data->Structs.size(), NumLayers = Data->Layers.size();
+  Counts.assign(NumStructs, LayerCounts());
+  vector<char> Status(NumStructs, 0);
+  iVec Order;
+  bVec WidePaths(NumStructs, false), Arrays(NumStructs, false);
+  LayerCount Zero = {0, 0, 0, 0, 0};
+  LayerCounts Totals(NumLayers, Zero);
+  vector<size_t> NumInstances(NumStructs, 0);
+  for(size_t n=0; n<TopStructs.size(); n++)
+   { int ns = TopStructs[n];
+     if (Data->Structs[ns]->IsPCell || Data->Structs[ns]->IsReferenced) continue;
+     CountEntities(&SD, Data, ns, Counts, Status, Order, WidePaths, Arrays);
+     for(size_t m=0; m<Counts[ns].size(); m++)
+      { LayerCount &Total = Totals[Counts[ns][m].nl];
+        Total.NumEntities    += Counts[ns][m].NumEntities;
+        Total.NumVertices    += Counts[ns][m].NumVertices;
+        Total.NumTexts       += Counts[ns][m].NumTexts;
+        Total.NumRepetitions += Counts[ns][m].NumRepetitions;
+      }
+     NumInstances[ns]=1;
+   }
+
+  // the number of times each structure is instantiated, visiting
+  // each structure before those it references
+  for(size_t n=Order.size(); n>0; n--)
+   { GDSIIStruct *s = Data->Structs[Order[n-1]];
+     size_t NumParents = NumInstances[Order[n-1]];
+     for(size_t ne=0; ne<s->Elements.size() && NumParents>0 && !s->IsPCell; ne++)
+      { GDSIIElement *e = s->Elements[ne];
+        if ( (e->Type==SREF || e->Type==AREF) && e->nsRef>=0 && e->nsRef<((int)NumStructs) )
+         NumInstances[e->nsRef] += NumParents*GetNumCopies(&SD, e);
+      }
+   }
+
+  // the flattened content of each structure instantiated more than
+  // once is computed once, in the structure's own coordinates,
+  // with the caches of the structures it references already in place
+  // (caches hold no repetitions, so compact arrays are not cached)
+  vector<CellCache *> Caches(NumStructs, (CellCache *)0);
+  for(size_t n=0; n<Order.size(); n++)
+   { int ns = Order[n];
+     if (NumInstances[ns]<2 || Counts[ns].size()==0) continue;
+     if (SD.CompactArrays && Arrays[ns]) continue;
+     StatusData CSD;
+     InitStatusData(&CSD, Data, 1.0, 1.0, LayerMask);
+     CSD.Cache = new CellCache;
+     CSD.Cache->HasWidePaths = WidePaths[ns];
+     CSD.Caches = &Caches;
+     CSD.Counts = &Counts;
+     AddStruct(&CSD, Data, ns, true);
+     Caches[ns] = CSD.Cache;
+   }
+  SD.Caches = &Caches;
+
+  // make room for the new entities after those already present
+  Table->resize(NumLayers);
+  SD.Next.resize(NumLayers);
+  size_t TotalEntities=0;
+  for(size_t nl=0; nl<NumLayers; nl++)
+   { FlatEntityList &List = (*Table)[nl];
+     if (Totals[nl].NumEntities==0 && List.Offsets.size()>0) continue;
+     Cursor &Next = SD.Next[nl];
+     Next.Entity = List.size();
+     Next.Vertex = (SD.Integer ? List.IXY.size() : List.XY.size())/2;
+     Next.Text   = List.Texts.size();
+     Next.Repetition = List.Repetitions.size();
+     if (SD.Integer)
+      List.IXY.resize( 2*(Next.Vertex + Totals[nl].NumVertices) );
+     else
+      List.XY.resize( 2*(Next.Vertex + Totals[nl].NumVertices) );
+     List.Offsets.resize( Next.Entity + Totals[nl].NumEntities + 1 );
+     List.Offsets.back() = Next.Vertex + Totals[nl].NumVertices;
+     List.Flags.resize( Next.Entity + Totals[nl].NumEntities );
+     List.Sources.resize( Next.Entity + Totals[nl].NumEntities );
+     List.Texts.resize( Next.Text + Totals[nl].NumTexts );
+     List.TextEntities.resize( Next.Text + Totals[nl].NumTexts );
+     List.Repetitions.resize( Next.Repetition + Totals[nl].NumRepetitions );
+     TotalEntities += Totals[nl].NumEntities;
+   }
+  SD.Table  = Table;
+  SD.Counts = &Counts;
+
+  // tasks of roughly 1/(16*NumThreads) of the total work balance
+  // the load without swamping the scheduler
+  if (NumThreads>1)
+   SD.MinTaskSize = TotalEntities/(16*NumThreads) + 1;
+  if (SD.MinTaskSize==0)
+   { for(size_t n=0; n<TopStructs.size(); n++)
+      AddStruct(&SD, Data, TopStructs[n], false);
+   }
+  else
+   { GDSIIData::Log("Flattening %lu entities on %i threads.",(unsigned long)TotalEntities,NumThreads);
+#pragma omp parallel num_threads(NumThreads)
+#pragma omp single
+     for(size_t n=0; n<TopStructs.size(); n++)
+      AddStruct(&SD, Data, TopStructs[n], false);
+   }
+
+  for(size_t ns=0; ns<NumStructs; ns++)
+   if (Caches[ns])
+    delete Caches[ns];
+}
+
+/***************************************************************/
+/* Prepare to flatten the hierarchy into FlatTable. Layers are */
+/* flattened on demand by FlattenLayers(), which also records  */
+/* the number of entities each top-level structure contributes */
+/* to each layer (used by Reload()).                           */
 /***************************************************************/
 void GDSIIData::Flatten(double CoordinateLengthUnit)
 {
@@ -306,16 +1164,526 @@ void GDSIIData::Flatten(double CoordinateLengthUnit)
       Log("Setting libGDSII length unit to %g meters.\n",CoordinateLengthUnit);
    }
 
+  LengthUnit = CoordinateLengthUnit;
+
+  ClearETable();
+  FlatTable.assign(Layers.size(), FlatEntityList());
+  ETable.assign(Layers.size(), EntityList());
+  IntegerTable.clear();
+  IntegerFlattened.clear();
+  Flattened.assign(Layers.size(), false);
+  EntityCounts.assign(Layers.size(), iVec(Structs.size(), 0));
+}
+
+void GDSIIData::FlattenLayers(const iVec &LayerList)
+{
+  pthread_mutex_lock(&FlattenMutex);
+  bVec LayerMask(Layers.size(), false);
+  bool Pending=false;
+  for(size_t nl=0; nl<Layers.size(); nl++)
+   if (!Flattened[nl])
+    { LayerMask[nl] = LayerList.size()==0 || find(LayerList.begin(), LayerList.end(), Layers[nl])!=LayerList.end();
+      Pending = Pending || LayerMask[nl];
+    }
+  if (!Pending)
+   { pthread_mutex_unlock(&FlattenMutex);
+     return;
+   }
+
+  iVec TopStructs(Structs.size());
+  for(size_t ns=0; ns<Structs.size(); ns++)
+   TopStructs[ns]=ns;
+  vector<LayerCounts> Counts;
+  FlattenStructs(this, TopStructs, &FlatTable, Counts, GetNumThreads(ReadOptions.NumThreads), &LayerMask);
+
+  for(size_t ns=0; ns<Structs.size(); ns++)
+   if (!Structs[ns]->IsPCell && !Structs[ns]->IsReferenced)
+    for(size_t n=0; n<Counts[ns].size(); n++)
+     EntityCounts[Counts[ns][n].nl][ns] = Counts[ns][n].NumEntities;
+  for(size_t nl=0; nl<Layers.size(); nl++)
+   if (LayerMask[nl])
+    Flattened[nl]=true;
+  pthread_mutex_unlock(&FlattenMutex);
+}
+
+/***************************************************************/
+/* Predict the size of the flattened design from the counting  */
+/* pass alone: each structure's per-layer counts are computed  */
+/* once, from those of the structures it references, weighted  */
+/* by their numbers of instances.                              */
+/***************************************************************/
+static FlatSize GetFlatSize(GDSIIData *Data, const LayerCount &LC)
+{
+  FlatSize Size;
+  Size.Layer          = Data->Layers[LC.nl];
+  Size.NumPolygons    = LC.NumEntities - LC.NumTexts;
+  Size.NumTexts       = LC.NumTexts;
+  Size.NumVertices    = LC.NumVertices;
+  Size.NumRepetitions = LC.NumRepetitions;
+  Size.NumBytes       = LC.NumEntities * (sizeof(size_t) + sizeof(unsigned char) + sizeof(EntitySource))
+                       +LC.NumVertices * 2*sizeof(double)
+                       +LC.NumTexts * (sizeof(const char *) + sizeof(size_t))
+                       +LC.NumRepetitions * sizeof(Repetition);
+  return Size;
+}
+
+FlatSizeList GDSIIData::EstimateFlatSize(const iVec &LayerList, vector<FlatSizeList> *CellSizes)
+{
+  bVec LayerMask(Layers.size(), false);
+  for(size_t nl=0; nl<Layers.size(); nl++)
+   LayerMask[nl] = LayerList.size()==0 || find(LayerList.begin(), LayerList.end(), Layers[nl])!=LayerList.end();
+
   StatusData SD;
-  InitStatusData(&SD, CoordinateLengthUnit, FileUnits[1]);
-  
+  InitStatusData(&SD, this, LengthUnit, FileUnits[1], &LayerMask);
+  SD.CompactArrays = ReadOptions.CompactArrays;
+
+  size_t NumStructs = Structs.size();
+  vector<LayerCounts> Counts(NumStructs);
+  vector<char> Status(NumStructs, 0);
+  iVec Order;
+  bVec WidePaths(NumStructs, false), Arrays(NumStructs, false);
+  LayerCount Zero = {0, 0, 0, 0, 0};
+  LayerCounts Totals(Layers.size(), Zero);
+  for(size_t ns=0; ns<NumStructs; ns++)
+   { CountEntities(&SD, this, ns, Counts, Status, Order, WidePaths, Arrays);
+     if (Structs[ns]->IsPCell || Structs[ns]->IsReferenced) continue;
+     for(size_t n=0; n<Counts[ns].size(); n++)
+      { LayerCount &Total = Totals[Counts[ns][n].nl];
+        Total.NumEntities    += Counts[ns][n].NumEntities;
+        Total.NumVertices    += Counts[ns][n].NumVertices;
+        Total.NumTexts       += Counts[ns][n].NumTexts;
+        Total.NumRepetitions += Counts[ns][n].NumRepetitions;
+      }
+   }
+
+  if (CellSizes)
+   { CellSizes->assign(NumStructs, FlatSizeList());
+     for(size_t ns=0; ns<NumStructs; ns++)
+      for(size_t n=0; n<Counts[ns].size(); n++)
+       (*CellSizes)[ns].push_back(GetFlatSize(this, Counts[ns][n]));
+   }
+
+  FlatSizeList Sizes;
+  for(size_t nl=0; nl<Layers.size(); nl++)
+   if (Totals[nl].NumEntities>0)
+    { Totals[nl].nl = nl;
+      Sizes.push_back(GetFlatSize(this, Totals[nl]));
+    }
+  return Sizes;
+}
+
+const FlatEntityList &GDSIIData::GetFlatEntities(size_t nl)
+{
+  pthread_mutex_lock(&FlattenMutex);
+  if (!Flattened[nl])
+   FlattenLayers(iVec(1,Layers[nl]));
+  pthread_mutex_unlock(&FlattenMutex);
+  return FlatTable[nl];
+}
+
+// appends each entity it visits to an EntityList
+class EntityListBuilder : public FlatEntityVisitor
+ {
+   public:
+     EntityListBuilder(GDSIIData *D, EntityList *E) : Data(D), Entities(E) {}
+     void Visit(const FlatEntityList &List, size_t ne, double DX, double DY)
+      { Entity E;
+        const double *XY = List.Vertices(ne);
+        E.XY.resize(2*List.NumVertices(ne));
+        for(size_t n=0; n<E.XY.size(); n+=2)
+         { E.XY[n+0] = XY[n+0] + DX;
+           E.XY[n+1] = XY[n+1] + DY;
+         }
+        E.Text   = (char *)List.Text(ne);
+        E.Closed = List.Closed(ne);
+        E.Label  = strdup(Data->GetLabel(List.Sources[ne]).c_str());
+        Entities->push_back(E);
+      }
+     GDSIIData *Data;
+     EntityList *Entities;
+ };
+
+const EntityList &GDSIIData::GetEntities(size_t nl)
+{
+  pthread_mutex_lock(&FlattenMutex);
+  const FlatEntityList &List = GetFlatEntities(nl);
+  EntityList &Entities = ETable[nl];
+  if (Entities.size()==0 && List.size()>0)
+   { Entities.reserve(List.NumExpanded());
+     EntityListBuilder Builder(this, &Entities);
+     List.Expand(&Builder);
+   }
+  pthread_mutex_unlock(&FlattenMutex);
+  return Entities;
+}
+
+EntityTable &GDSIIData::GetETable()
+{
+  pthread_mutex_lock(&FlattenMutex);
+  FlattenLayers();
+  for(size_t nl=0; nl<Layers.size(); nl++)
+   GetEntities(nl);
+  pthread_mutex_unlock(&FlattenMutex);
+  return ETable;
+}
+
+void GDSIIData::ClearETable()
+{
+  for(size_t nl=0; nl<ETable.size(); nl++)
+   for(size_t ne=0; ne<ETable[nl].size(); ne++)
+    free(ETable[nl][ne].Label);
+  ETable.clear();
+}
+
+string GDSIIData::GetLabel(const EntitySource &Source)
+{
+  GDSIIStruct *s  = Structs[Source.ns];
+  GDSIIElement *e = s->Elements[Source.ne];
+  char Label[1000];
+  if (e->Type==TEXT)
+   snprintf(Label,1000,"Struct %s element #%i (texttype %i)",s->Name->c_str(),Source.ne,e->TextType);
+  else if (e->Type==SREF || e->Type==AREF)
+   snprintf(Label,1000,"Struct %s element #%i (placeholder for %s)",s->Name->c_str(),Source.ne,e->SName->c_str());
+  else
+   snprintf(Label,1000,"Struct %s element #%i (%s)",s->Name->c_str(),Source.ne,e->Type==PATH ? "path" : "boundary");
+  return string(Label);
+}
+
+/***************************************************************/
+/* Integer mode: the layers are flattened in database units,   */
+/* with vertex coordinates written directly to IXY. The        */
+/* coordinates in the file are integers, and translations,     */
+/* reflections and rotations by multiples of 90 degrees only   */
+/* add, negate and exchange them, so for such transforms the   */
+/* coordinates are computed exactly in integer arithmetic.     */
+/* Only the vertices of wide-path outlines and of entities     */
+/* under other transforms (general rotations or magnification) */
+/* are rounded to the nearest integer; so are the instances of */
+/* AREFs whose pitch is not a whole number of database units,  */
+/* which are counted and reported once.                        */
+/***************************************************************/
+static size_t CountFractionalArrays(GDSIIData *Data)
+{
+  size_t Count=0;
+  for(size_t ns=0; ns<Data->Structs.size(); ns++)
+   { GDSIIStruct *s = Data->Structs[ns];
+     for(size_t ne=0; ne<s->Elements.size(); ne++)
+      { GDSIIElement *e = s->Elements[ne];
+        if (e->Type!=AREF || e->Columns<=0 || e->Rows<=0 || e->XY.size()<6) continue;
+        long long X0 = e->XY[0], Y0 = e->XY[1];
+        if (   (e->XY[2]-X0)%e->Columns || (e->XY[3]-Y0)%e->Columns
+            || (e->XY[4]-X0)%e->Rows    || (e->XY[5]-Y0)%e->Rows )
+         Count++;
+      }
+   }
+  return Count;
+}
+
+void GDSIIData::FlattenIntegerLayers(const iVec &LayerList)
+{
+  pthread_mutex_lock(&FlattenMutex);
+  if (IntegerFlattened.size()!=Layers.size())
+   { IntegerTable.assign(Layers.size(), FlatEntityList());
+     IntegerFlattened.assign(Layers.size(), false);
+     size_t NumFractional = CountFractionalArrays(this);
+     if (NumFractional)
+      Warn("%lu AREFs have a pitch that is not a whole number of database units; "
+           "their instances are rounded to the nearest database unit",(unsigned long)NumFractional);
+   }
+
+  bVec LayerMask(Layers.size(), false);
+  bool Pending=false;
+  for(size_t nl=0; nl<Layers.size(); nl++)
+   if (!IntegerFlattened[nl])
+    { LayerMask[nl] = LayerList.size()==0 || find(LayerList.begin(), LayerList.end(), Layers[nl])!=LayerList.end();
+      Pending = Pending || LayerMask[nl];
+    }
+  if (!Pending)
+   { pthread_mutex_unlock(&FlattenMutex);
+     return;
+   }
+
+  iVec TopStructs(Structs.size());
+  for(size_t ns=0; ns<Structs.size(); ns++)
+   TopStructs[ns]=ns;
+  vector<LayerCounts> Counts;
+  FlattenStructs(this, TopStructs, &IntegerTable, Counts, GetNumThreads(ReadOptions.NumThreads), &LayerMask, true);
+
   for(size_t nl=0; nl<Layers.size(); nl++)
-   { SD.CurrentLayer = Layers[nl];
-     SD.EntitiesThisLayer.clear();
-     for(size_t ns=0; ns<Structs.size(); ns++)
-      AddStruct(&SD,this,ns,false);
-     ETable.push_back(SD.EntitiesThisLayer);
+   if (LayerMask[nl])
+    IntegerFlattened[nl]=true;
+  pthread_mutex_unlock(&FlattenMutex);
+}
+
+const FlatEntityList &GDSIIData::GetIntegerEntities(size_t nl)
+{
+  pthread_mutex_lock(&FlattenMutex);
+  if (IntegerFlattened.size()!=Layers.size() || !IntegerFlattened[nl])
+   FlattenIntegerLayers(iVec(1,Layers[nl]));
+  pthread_mutex_unlock(&FlattenMutex);
+  return IntegerTable[nl];
+}
+
+double GDSIIData::GetDBUnit(double Unit)
+{ return FileUnits[1] / (Unit==0.0 ? LengthUnit : Unit); }
+
+// compute Data->StructExtents, if this has not yet been done
+static void InitStructExtents(GDSIIData *Data)
+{
+  pthread_mutex_lock(&(Data->FlattenMutex));
+  if (Data->StructExtents.size()!=Data->Structs.size())
+   { StatusData SD;
+     InitStatusData(&SD, Data, Data->LengthUnit, Data->FileUnits[1]);
+     Data->StructExtents.assign(Data->Structs.size(), vector<LayerExtent>());
+     vector<char> Status(Data->Structs.size(), 0);
+     for(size_t ns=0; ns<Data->Structs.size(); ns++)
+      GetStructExtents(&SD, Data, ns, Data->StructExtents, Status);
    }
+  pthread_mutex_unlock(&(Data->FlattenMutex));
+}
+
+/***************************************************************/
+/* Flatten the parts of the hierarchy that intersect Window,   */
+/* skipping each reference instance (and each column of AREF   */
+/* instances) whose bounding box, computed from the extents of */
+/* the referenced structure, misses the window.                */
+/***************************************************************/
+void GDSIIData::FlattenWindow(const BoundingBox &Window, FlatEntityTable *Table, const iVec &LayerList)
+{
+  bVec LayerMask(Layers.size(), false);
+  for(size_t nl=0; nl<Layers.size(); nl++)
+   LayerMask[nl] = LayerList.size()==0 || find(LayerList.begin(), LayerList.end(), Layers[nl])!=LayerList.end();
+
+  InitStructExtents(this);
+
+  StatusData SD;
+  InitStatusData(&SD, this, LengthUnit, FileUnits[1], &LayerMask);
+  Table->resize(Layers.size());
+  SD.AppendTable = Table;
+  SD.Window      = &Window;
+  SD.Extents     = &StructExtents;
+  for(size_t ns=0; ns<Structs.size(); ns++)
+   if (    !Structs[ns]->IsPCell && !Structs[ns]->IsReferenced
+        && StructInWindow(&SD, this, ns, SD.GTStack[0]) )
+    AddStruct(&SD, this, ns, false);
+}
+
+/***************************************************************/
+/* Flatten the hierarchy below a single structure, down to a   */
+/* given depth.                                                */
+/***************************************************************/
+bool GDSIIData::FlattenCell(const char *TopCell, FlatEntityTable *Table, int MaxDepth,
+                            const iVec &LayerList)
+{
+  if (ErrMsg)
+   { delete ErrMsg;
+     ErrMsg=0;
+   }
+  int ns = GetStructByName(TopCell);
+  if (ns==-1)
+   { ErrMsg = new string("no structure named " + string(TopCell));
+     return false;
+   }
+
+  bVec LayerMask(Layers.size(), false);
+  for(size_t nl=0; nl<Layers.size(); nl++)
+   LayerMask[nl] = LayerList.size()==0 || find(LayerList.begin(), LayerList.end(), Layers[nl])!=LayerList.end();
+
+  if (MaxDepth>=0)
+   InitStructExtents(this);
+
+  StatusData SD;
+  InitStatusData(&SD, this, LengthUnit, FileUnits[1], &LayerMask);
+  Table->resize(Layers.size());
+  SD.AppendTable = Table;
+  SD.MaxDepth    = MaxDepth;
+  SD.Extents     = &StructExtents;
+  AddStruct(&SD, this, ns, true); // flattened even if it is referenced elsewhere
+  return true;
+}
+
+/***************************************************************/
+/* FlatEntityIterator: the depth-first walk of AddStruct() and */
+/* AddASRef(), with the recursion unrolled onto an explicit    */
+/* stack so that it can be suspended after each entity.        */
+/* Entities are generated by AddBoundary(), AddPath() and      */
+/* AddText() into a scratch table, which is cleared before the */
+/* next one is generated.                                      */
+/***************************************************************/
+
+// position of the walk in one structure on the current path from
+// the top: element #ne of structure #ns, and, if that element is an
+// SREF or AREF, the next of its instances to visit
+typedef struct FlatIteratorFrame
+ { int ns;
+   size_t ne;
+   size_t ni;
+ } FlatIteratorFrame;
+
+struct FlatIteratorState
+ { GDSIIData *Data;
+   StatusData SD;            // SD.GTStack[n] = transform of structure Frames[n]
+   vector<FlatIteratorFrame> Frames;
+   size_t NextTop;           // next top-level structure to walk
+   bVec HasContent;          // HasContent[ns] = structure ns has content on the layers being flattened
+   FlatEntityTable Scratch;  // Scratch[nl] holds the current entity, if it is on layer Data->Layers[nl]
+   int nl;                   // -1 before the first entity and after the last
+ };
+
+FlatEntityIterator::FlatEntityIterator(GDSIIData *Data, const iVec &LayerList)
+{
+  iVec &Layers = Data->Layers;
+  bVec LayerMask(Layers.size(), false);
+  for(size_t nl=0; nl<Layers.size(); nl++)
+   LayerMask[nl] = LayerList.size()==0 || find(LayerList.begin(), LayerList.end(), Layers[nl])!=LayerList.end();
+
+  State = new FlatIteratorState;
+  State->Data = Data;
+  InitStatusData(&(State->SD), Data, Data->LengthUnit, Data->FileUnits[1], &LayerMask);
+  State->SD.AppendTable = &(State->Scratch);
+  State->Scratch.resize(Layers.size());
+  State->NextTop = 0;
+  State->nl      = -1;
+
+  InitStructExtents(Data);
+  State->HasContent.assign(Data->Structs.size(), false);
+  for(size_t ns=0; ns<Data->Structs.size(); ns++)
+   { const vector<LayerExtent> &Extents = Data->StructExtents[ns];
+     for(size_t n=0; n<Extents.size() && !State->HasContent[ns]; n++)
+      State->HasContent[ns] = LayerMask[Extents[n].nl];
+   }
+}
+
+FlatEntityIterator::~FlatEntityIterator()
+{
+  delete State;
+}
+
+bool FlatEntityIterator::Next()
+{
+  FlatIteratorState *S = State;
+  GDSIIData *Data      = S->Data;
+  StatusData *SD       = &(S->SD);
+  if (S->nl!=-1)
+   { FlatEntityList &List = S->Scratch[S->nl];
+     List.XY.clear();
+     List.Offsets.clear();
+     List.Flags.clear();
+     List.Texts.clear();
+     List.TextEntities.clear();
+     List.Sources.clear();
+     S->nl = -1;
+   }
+
+  for(;;)
+   { 
+     // start on the next top-level structure with content
+     if (S->Frames.size()==0)
+      { int NumStructs = Data->Structs.size();
+        for(; S->NextTop<(size_t)NumStructs; S->NextTop++)
+         { GDSIIStruct *s = Data->Structs[S->NextTop];
+           if (!s->IsPCell && !s->IsReferenced && S->HasContent[S->NextTop]) break;
+         }
+        if (S->NextTop==(size_t)NumStructs) return false;
+        FlatIteratorFrame Top = { (int)(S->NextTop++), 0, 0 };
+        GTransform Identity = {1.0, 0.0, 0.0, 1.0, 0.0, 0.0, GT_IDENTITY, true};
+        S->Frames.push_back(Top);
+        SD->GTStack.assign(1, Identity);
+        continue;
+      }
+
+     FlatIteratorFrame &F = S->Frames.back();
+     int ns = F.ns;
+     GDSIIStruct *s = Data->Structs[ns];
+     if (F.ne>=s->Elements.size())
+      { S->Frames.pop_back();
+        SD->GTStack.pop_back();
+        continue;
+      }
+
+     int ne = F.ne;
+     GDSIIElement *e = s->Elements[ne];
+     if (e->Type==SREF || e->Type==AREF)
+      { 
+        int nsRef = e->nsRef;
+        if (F.ni==0)
+         { if ( nsRef==-1 && !Data->ReadOptions.StructName.empty() )
+            { F.ne++;
+              continue;
+            }
+           if ( nsRef==-1 || nsRef>=((int)(Data->Structs.size())) )
+            GDSIIData::ErrExit("structure %i (%s), element %i: REF to unknown structure %s",ns,s->Name,ne,e->SName);
+         }
+        if (F.ni>=GetNumInstances(e) || Data->Structs[nsRef]->IsPCell || !S->HasContent[nsRef])
+         { F.ne++;
+           F.ni=0;
+           continue;
+         }
+
+        // the transform of instance #ni, as in AddASRef() and AddColumn()
+        double Mag   = (e->Type==SREF) ? e->Mag   : 1.0;
+        double Angle = (e->Type==SREF) ? e->Angle : 0.0;
+        bool   Refl  = (e->Type==SREF) ? e->Refl  : false;
+        const GTransform &Parent = SD->GTStack.back();
+        GTransform GT;
+        ComposeGTransform(Parent, Mag, Angle, Refl, &GT);
+        double X0 = (double)e->XY[0], Y0 = (double)e->XY[1];
+        if (e->Type==AREF)
+         { int NC = e->Columns, NR = e->Rows;
+           int nc = F.ni / NR, nr = F.ni % NR;
+           double DeltaXYC[2], DeltaXYR[2];
+           DeltaXYC[0] = ((double)e->XY[2] - X0) / NC;
+           DeltaXYC[1] = ((double)e->XY[3] - Y0) / NC;
+           DeltaXYR[0] = ((double)e->XY[4] - X0) / NR;
+           DeltaXYR[1] = ((double)e->XY[5] - Y0) / NR;
+           X0 = X0 + nc*DeltaXYC[0] + nr*DeltaXYR[0];
+           Y0 = Y0 + nc*DeltaXYC[1] + nr*DeltaXYR[1];
+         }
+        SetGTOrigin(Parent, X0, Y0, &GT);
+
+        F.ni++;
+        FlatIteratorFrame Child = { nsRef, 0, 0 };
+        S->Frames.push_back(Child); // invalidates F
+        SD->GTStack.push_back(GT);
+        continue;
+      }
+
+     F.ne++;
+     if (e->Type!=BOUNDARY && e->Type!=PATH && e->Type!=TEXT) continue;
+     int nl = GetLayerIndex(SD, e->Layer);
+     if (nl==-1) continue;
+     if (e->Type==BOUNDARY)
+      AddBoundary(SD, Data, ns, ne);
+     else if (e->Type==PATH)
+      AddPath(SD, Data, ns, ne);
+     else
+      AddText(SD, Data, ns, ne);
+     S->nl = nl;
+     return true;
+   }
+}
+
+const FlatEntityList &FlatEntityIterator::Entity() const
+{
+  return State->Scratch[State->nl==-1 ? 0 : State->nl];
+}
+
+int FlatEntityIterator::Layer() const
+{
+  return State->nl==-1 ? -1 : State->Data->Layers[State->nl];
+}
+
+/***************************************************************/
+/* Append to (*Table)[nl] the entities on layer Layers[nl]     */
+/* (for each nl selected by LayerMask, or for all layers if it */
+/* is 0) obtained by flattening structure ns (if it is a       */
+/* top-level structure), in the length unit set by the last    */
+/* call to Flatten().                                          */
+/***************************************************************/
+void GDSIIData::FlattenStruct(int ns, FlatEntityTable *Table, const bVec *LayerMask)
+{
+  vector<LayerCounts> Counts;
+  FlattenStructs(this, iVec(1,ns), Table, Counts, 1, LayerMask);
 }
 
 /***************************************************************/
@@ -405,3 +1773,81 @@ void WriteGMSHFile(EntityTable ETable, iVec Layers, const char *FileBase, bool S
 }
 
 } // namespace libGDSII
+
+/***************************************************************/
+/* FlatEntityList methods                                      */
+/***************************************************************/
+const char *FlatEntityList::Text(size_t ne) const
+{
+  if (!IsText(ne)) return 0;
+  vector<size_t>::const_iterator it = lower_bound(TextEntities.begin(), TextEntities.end(), ne);
+  return Texts[it - TextEntities.begin()];
+}
+
+void FlatEntityList::Append(const FlatEntityList &List, size_t First, size_t Last)
+{
+  if (First>=Last) return;
+  if (Offsets.size()==0) Offsets.push_back(0);
+  size_t NV0 = XY.size()/2, Shift = NV0 - List.Offsets[First];
+  XY.insert(XY.end(), List.XY.begin() + 2*List.Offsets[First], List.XY.begin() + 2*List.Offsets[Last]);
+  Offsets.pop_back();
+  for(size_t ne=First; ne<=Last; ne++)
+   Offsets.push_back(List.Offsets[ne] + Shift);
+  Flags.insert(Flags.end(), List.Flags.begin() + First, List.Flags.begin() + Last);
+  Sources.insert(Sources.end(), List.Sources.begin() + First, List.Sources.begin() + Last);
+
+  size_t ne0 = size() - (Last-First);
+  vector<size_t>::const_iterator it = lower_bound(List.TextEntities.begin(), List.TextEntities.end(), First);
+  for(size_t nt=it - List.TextEntities.begin(); nt<List.TextEntities.size() && List.TextEntities[nt]<Last; nt++)
+   { Texts.push_back(List.Texts[nt]);
+     TextEntities.push_back(List.TextEntities[nt] - First + ne0);
+   }
+
+  for(size_t nr=0; nr<List.Repetitions.size(); nr++)
+   if (List.Repetitions[nr].First>=First && List.Repetitions[nr].Last<=Last)
+    { Repetitions.push_back(List.Repetitions[nr]);
+      Repetitions.back().First += ne0 - First;
+      Repetitions.back().Last  += ne0 - First;
+    }
+}
+
+// count, and visit if Visitor is nonzero, the copies of entities
+// First...Last-1 of List displaced by (DX,DY), expanding the
+// repetitions numbered nr and higher
+static size_t ExpandEntities(const FlatEntityList &List, size_t First, size_t Last, size_t nr,
+                             double DX, double DY, FlatEntityVisitor *Visitor)
+{
+  const vector<Repetition> &Repetitions = List.Repetitions;
+  size_t Count=0;
+  for(size_t ne=First; ne<Last; )
+   { 
+     // skip the repetitions contained in one just expanded
+     while (nr<Repetitions.size() && Repetitions[nr].First<ne)
+      nr++;
+
+     if (nr==Repetitions.size() || Repetitions[nr].First!=ne)
+      { if (Visitor) Visitor->Visit(List, ne, DX, DY);
+        Count++;
+        ne++;
+        continue;
+      }
+
+     const Repetition &R = Repetitions[nr];
+     if (!Visitor)
+      Count += ((size_t)R.Columns)*R.Rows*ExpandEntities(List, R.First, R.Last, nr+1, 0.0, 0.0, 0);
+     else
+      for(int nc=0; nc<R.Columns; nc++)
+       for(int nrr=0; nrr<R.Rows; nrr++)
+        Count += ExpandEntities(List, R.First, R.Last, nr+1,
+                                DX + nc*R.ColumnXY[0] + nrr*R.RowXY[0],
+                                DY + nc*R.ColumnXY[1] + nrr*R.RowXY[1], Visitor);
+     ne = R.Last;
+   }
+  return Count;
+}
+
+size_t FlatEntityList::NumExpanded() const
+{ return Repetitions.size()==0 ? size() : ExpandEntities(*this, 0, size(), 0, 0.0, 0.0, 0); }
+
+void FlatEntityList::Expand(FlatEntityVisitor *Visitor) const
+{ ExpandEntities(*this, 0, size(), 0, 0.0, 0.0, Visitor); }
@@ -0,0 +1,98 @@
+/* Copyright (C) 2005-2017 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * GDSIIArena.cc -- chunked storage for the elements of GDSII structures
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <new>
+#include <string>
+
+#include "GDSIIArena.h"
+
+using namespace std;
+namespace libGDSII {
+
+// chunk sizes start small, so that arenas holding only a few
+// elements stay small, and double up to a maximum
+#define MIN_CHUNK_SIZE (1<<16)
+#define MAX_CHUNK_SIZE (1<<24)
+
+// alignment of all allocations
+#define ARENA_ALIGNMENT 16
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+GDSIIArena::GDSIIArena()
+{
+  Next           = 0;
+  Remaining      = 0;
+  ChunkSize      = MIN_CHUNK_SIZE;
+  BytesAllocated = 0;
+}
+
+GDSIIArena::~GDSIIArena()
+{
+  for(size_t nc=0; nc<Chunks.size(); nc++)
+   free(Chunks[nc]);
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+void *GDSIIArena::Allocate(size_t NumBytes)
+{
+  NumBytes = (NumBytes + ARENA_ALIGNMENT - 1) & ~((size_t)(ARENA_ALIGNMENT-1));
+  if (NumBytes > Remaining)
+   { 
+     // requests too large for a chunk get a chunk of their own,
+     // leaving the current chunk open for further allocations
+     if (NumBytes > ChunkSize/4)
+      { char *Chunk = (char *)malloc(NumBytes);
+        if (!Chunk) throw std::bad_alloc();
+        Chunks.push_back(Chunk);
+        BytesAllocated += NumBytes;
+        return Chunk;
+      }
+     Next = (char *)malloc(ChunkSize);
+     if (!Next) throw std::bad_alloc();
+     Chunks.push_back(Next);
+     Remaining = ChunkSize;
+     BytesAllocated += ChunkSize;
+     if (ChunkSize < MAX_CHUNK_SIZE)
+      ChunkSize *= 2;
+   }
+  void *p = Next;
+  Next      += NumBytes;
+  Remaining -= NumBytes;
+  return p;
+}
+
+GDSIIElement *GDSIIArena::NewElement()
+{ return new(Allocate(sizeof(GDSIIElement))) GDSIIElement(); }
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+const string *GDSIIArena::Intern(const char *Name)
+{ return &( *(Names.insert(string(Name)).first) ); }
+
+} // namespace libGDSII
@@ -0,0 +1,81 @@
+/* Copyright (C) 2005-2017 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * GDSIIArena.h -- internal definitions for the storage arenas holding
+ *              -- the elements of GDSII structures (not installed)
+ */
+#ifndef GDSIIARENA_H
+#define GDSIIARENA_H
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+
+#include "libGDSII.h"
+
+namespace libGDSII {
+
+/***************************************************************/
+/* A GDSIIArena hands out storage for GDSIIElements and their  */
+/* XY data from large contiguous chunks, so that elements read */
+/* in sequence lie next to each other in memory and the whole  */
+/* hierarchy is released at once rather than element by       */
+/* element. Memory obtained from an arena never moves and      */
+/* remains valid until the arena is deleted.                   */
+/*                                                             */
+/* An arena also interns structure names: Intern() returns the */
+/* same pointer for every occurrence of a given name, so that  */
+/* SREFs and AREFs share a single copy of the names they use.  */
+/*                                                             */
+/* Arenas are not thread-safe; each parsing thread uses its    */
+/* own.                                                        */
+/***************************************************************/
+class GDSIIArena
+ {
+   public:
+     GDSIIArena();
+     ~GDSIIArena();
+
+     // storage suitably aligned for any type
+     void *Allocate(size_t NumBytes);
+
+     // a new element, with all fields zeroed or empty; the element's
+     // destructor is not run by the arena (see DeleteGDSIIStruct)
+     GDSIIElement *NewElement();
+
+     // uninitialized storage for NumValues integers
+     int *NewInts(size_t NumValues)
+      { return (int *)Allocate(NumValues*sizeof(int)); }
+
+     const std::string *Intern(const char *Name);
+
+     size_t GetBytesAllocated() { return BytesAllocated; }
+
+   private:
+     std::vector<char *> Chunks;
+     char *Next;          // next free byte in the current chunk
+     size_t Remaining;    // free bytes left in the current chunk
+     size_t ChunkSize;    // size of the next chunk to be allocated
+     size_t BytesAllocated;
+
+     std::unordered_set<std::string> Names;
+ };
+
+} // namespace libGDSII
+
+#endif // GDSIIARENA_H
@@ -0,0 +1,129 @@
+/* Copyright (C) 2005-2017 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * GDSIIDecode.cc -- bulk decoding of big-endian integer and
+ *                -- excess-64 real payloads of GDSII records
+ */
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "GDSIIReader.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define HAVE_X86_DISPATCH
+  #include <immintrin.h>
+#endif
+
+namespace libGDSII {
+
+typedef void (*Integer4Decoder)(const BYTE *Bytes, int *Values, size_t NumValues);
+
+/***************************************************************/
+/* portable version, which compilers generally reduce to one   */
+/* byte-swap instruction per value                             */
+/***************************************************************/
+static void DecodeInteger4Scalar(const BYTE *Bytes, int *Values, size_t NumValues)
+{
+  for(size_t n=0; n<NumValues; n++, Bytes+=4)
+   Values[n] = (int)(   ((unsigned)Bytes[0]<<24) | ((unsigned)Bytes[1]<<16)
+                      | ((unsigned)Bytes[2]<< 8) | ((unsigned)Bytes[3]    ) );
+}
+
+/***************************************************************/
+/* SIMD versions, byte-swapping 4 (SSSE3) or 8 (AVX2) values   */
+/* per instruction                                             */
+/***************************************************************/
+#ifdef HAVE_X86_DISPATCH
+__attribute__((target("ssse3")))
+static void DecodeInteger4SSSE3(const BYTE *Bytes, int *Values, size_t NumValues)
+{
+  const __m128i Swap = _mm_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+  size_t n=0;
+  for(; n+4<=NumValues; n+=4)
+   { __m128i V = _mm_loadu_si128( (const __m128i *)(Bytes + 4*n) );
+     _mm_storeu_si128( (__m128i *)(Values + n), _mm_shuffle_epi8(V, Swap) );
+   }
+  DecodeInteger4Scalar(Bytes + 4*n, Values + n, NumValues - n);
+}
+
+__attribute__((target("avx2")))
+static void DecodeInteger4AVX2(const BYTE *Bytes, int *Values, size_t NumValues)
+{
+  const __m256i Swap = _mm256_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3,
+                                       12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+  size_t n=0;
+  for(; n+8<=NumValues; n+=8)
+   { __m256i V = _mm256_loadu_si256( (const __m256i *)(Bytes + 4*n) );
+     _mm256_storeu_si256( (__m256i *)(Values + n), _mm256_shuffle_epi8(V, Swap) );
+   }
+  DecodeInteger4SSSE3(Bytes + 4*n, Values + n, NumValues - n);
+}
+#endif
+
+/***************************************************************/
+/* choose the best decoder for the CPU we are running on; the  */
+/* environment variable LIBGDSII_NO_SIMD forces the portable   */
+/* version                                                     */
+/***************************************************************/
+static Integer4Decoder SelectInteger4Decoder()
+{
+  if (getenv("LIBGDSII_NO_SIMD"))
+   return DecodeInteger4Scalar;
+#ifdef HAVE_X86_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+   return DecodeInteger4AVX2;
+  if (__builtin_cpu_supports("ssse3"))
+   return DecodeInteger4SSSE3;
+#endif
+  return DecodeInteger4Scalar;
+}
+
+/***************************************************************/
+/* Decode NumValues consecutive big-endian INTEGER_4 values.   */
+/***************************************************************/
+void DecodeInteger4Array(const BYTE *Bytes, int *Values, size_t NumValues)
+{
+  static Integer4Decoder Decoder = SelectInteger4Decoder();
+  Decoder(Bytes, Values, NumValues);
+}
+
+/***************************************************************/
+/* Decode an excess-64 real: sign bit, 7-bit base-16 exponent, */
+/* and a 3-byte (REAL_4) or 7-byte (REAL_8) mantissa. The      */
+/* mantissa is assembled as an integer and scaled by ldexp(),  */
+/* which only adjusts the binary exponent.                     */
+/***************************************************************/
+double DecodeReal(const BYTE *Bytes, int NumMantissaBytes)
+{
+  unsigned long long Mantissa=0;
+  for(int n=1; n<=NumMantissaBytes; n++)
+   Mantissa = (Mantissa<<8) | Bytes[n];
+  int Exponent = (Bytes[0] & 0x7F) - 64;
+  double Value = ldexp( (double)Mantissa, 4*Exponent - 8*NumMantissaBytes );
+  return (Bytes[0] & 0x80) ? -Value : Value;
+}
+
+void DecodeReal8Array(const BYTE *Bytes, double *Values, size_t NumValues)
+{
+  for(size_t n=0; n<NumValues; n++, Bytes+=8)
+   Values[n] = DecodeReal(Bytes, 7);
+}
+
+} // namespace libGDSII
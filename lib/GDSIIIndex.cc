@@ -0,0 +1,348 @@
+/* Copyright (C) 2005-2017 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * GDSIIIndex.cc -- sidecar index files recording the location of
+ *               -- each structure in a GDSII file
+ */
+
+#ifdef HAVE_CONFIG_H
+  #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <string>
+#include <set>
+#include <vector>
+
+#include "libGDSII.h"
+#include "GDSIIReader.h"
+
+using namespace std;
+namespace libGDSII {
+
+#define INDEX_SIGNATURE "# libGDSII index"
+
+/***************************************************************/
+/* get the size and modification time of a file, used to tell  */
+/* whether an index file is still up to date; the nanoseconds  */
+/* part of the time distinguishes files rewritten within the   */
+/* same second (where the file system records it)              */
+/***************************************************************/
+static bool GetFileStamp(const char *FileName, size_t *FileSize, long *FileTime, long *FileTimeNS)
+{
+  struct stat FileInfo;
+  if ( stat(FileName, &FileInfo)!=0 )
+   return false;
+  *FileSize   = FileInfo.st_size;
+  *FileTime   = FileInfo.st_mtime;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC)
+  *FileTimeNS = FileInfo.st_mtim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC_TV_NSEC)
+  *FileTimeNS = FileInfo.st_mtimespec.tv_nsec;
+#else
+  *FileTimeNS = 0;
+#endif
+  return true;
+}
+
+/***************************************************************/
+/* hash of the first HeaderLength bytes of a GDSII file (the   */
+/* library header, whose BGNLIB record holds the time at which */
+/* the library was last modified)                              */
+/***************************************************************/
+static bool HashLibraryHeader(const char *FileName, size_t HeaderLength,
+                              unsigned long long *Hash)
+{
+  GDSIIReader Reader;
+  string *ErrMsg = Reader.Open(FileName);
+  if (ErrMsg)
+   { delete ErrMsg;
+     return false;
+   }
+  const BYTE *Bytes = Reader.Peek(HeaderLength);
+  if (!Bytes)
+   return false;
+  *Hash = HashGDSIIBytes(GDSII_HASH_SEED, Bytes, HeaderLength);
+  return true;
+}
+
+/***************************************************************/
+/* Build the index by skipping from record header to record    */
+/* header; only the small STRNAME, SNAME and LAYER records are */
+/* decoded, all other payloads are passed over unread.         */
+/*                                                             */
+/* If StructHashes is non-null, the same pass also computes    */
+/* the content hash of the library header (in *HeaderHash) and */
+/* of each structure (one per index entry), exactly as parsing */
+/* with ReadOptions.Reloadable does; this requires the payload */
+/* of every record to be looked at.                            */
+/***************************************************************/
+string *IndexGDSIIFile(const char *GDSIIFileName, GDSIIIndex *Index,
+                       unsigned long long *HeaderHash,
+                       vector<unsigned long long> *StructHashes)
+{
+  GDSIIReader Reader;
+  string *ErrMsg = Reader.Open(GDSIIFileName);
+  if (ErrMsg)
+   return ErrMsg;
+
+  Index->Entries.clear();
+  Index->HeaderLength = 0;
+  Index->HeaderHash = 0;
+  GetFileStamp(GDSIIFileName, &(Index->FileSize), &(Index->FileTime), &(Index->FileTimeNS));
+
+  if (StructHashes)
+   { StructHashes->clear();
+     *HeaderHash = GDSII_HASH_SEED;
+   }
+  unsigned long long Hash = GDSII_HASH_SEED;
+
+  set<string> Children;
+  set<int> Layers;
+  GDSIIIndexEntry *Entry=0;
+  bool Done=false;
+  while(!Done)
+   {
+     size_t RecordSize, Offset=Reader.Tell();
+     int RType;
+     if ( !PeekGDSIIRecordHeader(&Reader, &RecordSize, &RType) )
+      return new string("unexpected end of file or invalid record");
+
+     if (StructHashes && RType!=RTYPE_ENDLIB)
+      { const BYTE *Bytes = Reader.Peek(RecordSize);
+        if (!Bytes)
+         return new string("unexpected end of file");
+        if (RType==RTYPE_BGNSTR)
+         Hash = GDSII_HASH_SEED;
+        Hash = HashGDSIIRecord(Hash, Bytes, Bytes+4, RecordSize-4);
+        if (Index->Entries.size()==0 && RType!=RTYPE_BGNSTR)
+         *HeaderHash = Hash;
+        else if (RType==RTYPE_ENDSTR)
+         StructHashes->push_back(Hash);
+      }
+
+     if ( RType!=RTYPE_STRNAME && RType!=RTYPE_SNAME && RType!=RTYPE_LAYER )
+      { Reader.Skip(RecordSize);
+        switch(RType)
+         { case RTYPE_BGNSTR:
+            if (Index->Entries.size()==0)
+             Index->HeaderLength = Offset;
+            Index->Entries.push_back(GDSIIIndexEntry());
+            Entry = &(Index->Entries.back());
+            Entry->Offset = Offset;
+            Children.clear();
+            Layers.clear();
+            break;
+
+           case RTYPE_ENDSTR:
+            if (!Entry)
+             return new string("unexpected record ENDSTR");
+            Entry->Length = Reader.Tell() - Entry->Offset;
+            Entry->Children.assign(Children.begin(), Children.end());
+            Entry->Layers.assign(Layers.begin(), Layers.end());
+            Entry=0;
+            break;
+
+           case RTYPE_ENDLIB:
+            Done=true;
+            break;
+         };
+        continue;
+      }
+
+     GDSIIRecord Record;
+     if ( (ErrMsg=ReadGDSIIRecord(&Reader, &Record)) )
+      return ErrMsg;
+     if (!Entry)
+      return new string(string("unexpected record ") + GetRecordTypeName(RType));
+     char Buffer[33];
+     if (RType==RTYPE_STRNAME)
+      Entry->Name = GetRecordString(&Record, Buffer);
+     else if (RType==RTYPE_SNAME)
+      Children.insert( GetRecordString(&Record, Buffer) );
+     else
+      Layers.insert( GetRecordInt(&Record, 0) );
+   }
+
+  Reader.Close();
+  if (StructHashes && StructHashes->size()!=Index->Entries.size())
+   return new string("unterminated structure");
+  if ( !HashLibraryHeader(GDSIIFileName, Index->HeaderLength, &(Index->HeaderHash)) )
+   return new string("could not read library header");
+  return 0;
+}
+
+string *BuildGDSIIIndex(const char *GDSIIFileName, GDSIIIndex *Index)
+{
+  return IndexGDSIIFile(GDSIIFileName, Index, 0, 0);
+}
+
+/***************************************************************/
+/* The index file is a simple text file:                       */
+/*                                                             */
+/*  # libGDSII index                                           */
+/*  FILE size mtime mtime_nsec                                 */
+/*  HEADER length hash                                         */
+/*  STRUCT offset length name                                  */
+/*  CHILD name                                                 */
+/*  LAYERS n l1 l2 ... ln                                      */
+/*  STRUCT ...                                                 */
+/*                                                             */
+/* with one CHILD line per referenced structure. Names occupy  */
+/* the remainder of the line, as they may contain spaces.      */
+/***************************************************************/
+bool WriteGDSIIIndex(GDSIIIndex *Index, const char *IndexFileName)
+{
+  FILE *f=fopen(IndexFileName,"w");
+  if (!f) return false;
+  fprintf(f,"%s\n",INDEX_SIGNATURE);
+  fprintf(f,"FILE %lu %li %li\n",(unsigned long)Index->FileSize,Index->FileTime,Index->FileTimeNS);
+  fprintf(f,"HEADER %lu %llx\n",(unsigned long)Index->HeaderLength,Index->HeaderHash);
+  for(size_t ns=0; ns<Index->Entries.size(); ns++)
+   { GDSIIIndexEntry *Entry = &(Index->Entries[ns]);
+     fprintf(f,"STRUCT %lu %lu %s\n",(unsigned long)Entry->Offset,
+                                     (unsigned long)Entry->Length,
+                                     Entry->Name.c_str());
+     for(size_t nc=0; nc<Entry->Children.size(); nc++)
+      fprintf(f,"CHILD %s\n",Entry->Children[nc].c_str());
+     fprintf(f,"LAYERS %lu",(unsigned long)Entry->Layers.size());
+     for(size_t nl=0; nl<Entry->Layers.size(); nl++)
+      fprintf(f," %i",Entry->Layers[nl]);
+     fprintf(f,"\n");
+   }
+  fclose(f);
+  return true;
+}
+
+// strip the trailing newline from a line read by fgets
+static char *Chomp(char *Line)
+{ int L=strlen(Line);
+  while( L>0 && (Line[L-1]=='\n' || Line[L-1]=='\r') )
+   Line[--L]=0;
+  return Line;
+}
+
+bool ReadGDSIIIndex(const char *IndexFileName, GDSIIIndex *Index)
+{
+  FILE *f=fopen(IndexFileName,"r");
+  if (!f) return false;
+
+  Index->Entries.clear();
+  char Line[1000];
+  bool OK = fgets(Line,1000,f) && !strncmp(Line,INDEX_SIGNATURE,strlen(INDEX_SIGNATURE));
+  unsigned long FileSize, HeaderLength;
+  OK = OK && fgets(Line,1000,f) && 3==sscanf(Line,"FILE %lu %li %li",&FileSize,&(Index->FileTime),&(Index->FileTimeNS));
+  OK = OK && fgets(Line,1000,f) && 2==sscanf(Line,"HEADER %lu %llx",&HeaderLength,&(Index->HeaderHash));
+  Index->FileSize     = FileSize;
+  Index->HeaderLength = HeaderLength;
+
+  GDSIIIndexEntry *Entry=0;
+  while( OK && fgets(Line,1000,f) )
+   { Chomp(Line);
+     if (!strncmp(Line,"STRUCT ",7))
+      { unsigned long Offset, Length;
+        int NumChars=0;
+        OK = (2==sscanf(Line+7,"%lu %lu %n",&Offset,&Length,&NumChars) && NumChars>0);
+        Index->Entries.push_back(GDSIIIndexEntry());
+        Entry = &(Index->Entries.back());
+        Entry->Offset = Offset;
+        Entry->Length = Length;
+        Entry->Name   = string(Line+7+NumChars);
+      }
+     else if (Entry && !strncmp(Line,"CHILD ",6))
+      Entry->Children.push_back(string(Line+6));
+     else if (Entry && !strncmp(Line,"LAYERS ",7))
+      { char *s=Line+7;
+        int NumLayers=strtol(s,&s,10);
+        for(int nl=0; nl<NumLayers; nl++)
+         Entry->Layers.push_back(strtol(s,&s,10));
+      }
+     else
+      OK=false;
+   }
+  fclose(f);
+  return OK;
+}
+
+/***************************************************************/
+/* Get the index of a GDSII file from its sidecar index file   */
+/* (by default GDSIIFileName.idx), first (re)creating the      */
+/* index file if it is missing or out of date. If the index    */
+/* file cannot be written, the index is still returned.        */
+/* Returns 0 (and sets *ErrMsg, if non-null) on failure.       */
+/***************************************************************/
+GDSIIIndex *GetGDSIIIndex(const char *GDSIIFileName, const char *IndexFileName,
+                          string **ErrMsg)
+{
+  string DefaultIndexFileName = string(GDSIIFileName) + ".idx";
+  if (IndexFileName==0 || IndexFileName[0]==0)
+   IndexFileName = DefaultIndexFileName.c_str();
+
+  size_t FileSize;
+  long FileTime, FileTimeNS;
+  if ( !GetFileStamp(GDSIIFileName, &FileSize, &FileTime, &FileTimeNS) )
+   { if (ErrMsg) *ErrMsg = new string(string("could not open ") + GDSIIFileName);
+     return 0;
+   }
+
+  // the index is up to date if the file's size, modification
+  // time and library header are all unchanged
+  GDSIIIndex *Index = new GDSIIIndex;
+  unsigned long long HeaderHash;
+  if (    ReadGDSIIIndex(IndexFileName, Index)
+       && Index->FileSize==FileSize && Index->FileTime==FileTime
+       && Index->FileTimeNS==FileTimeNS
+       && HashLibraryHeader(GDSIIFileName, Index->HeaderLength, &HeaderHash)
+       && Index->HeaderHash==HeaderHash
+     )
+   return Index;
+
+  GDSIIData::Log("Indexing GDSII file %s...",GDSIIFileName);
+  string *BuildErrMsg = BuildGDSIIIndex(GDSIIFileName, Index);
+  if (BuildErrMsg)
+   { delete Index;
+     if (ErrMsg)
+      *ErrMsg = BuildErrMsg;
+     else
+      delete BuildErrMsg;
+     return 0;
+   }
+  if ( WriteGDSIIIndex(Index, IndexFileName) )
+   GDSIIData::Log("Wrote index of %lu structures to %s.",Index->Entries.size(),IndexFileName);
+  else
+   GDSIIData::Warn("could not write index file %s",IndexFileName);
+  return Index;
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+GDSIIIndexEntry *FindGDSIIIndexEntry(GDSIIIndex *Index, const char *StructName)
+{
+  for(size_t ns=0; ns<Index->Entries.size(); ns++)
+   if ( Index->Entries[ns].Name == StructName )
+    return &(Index->Entries[ns]);
+  return 0;
+}
+
+} // namespace libGDSII
@@ -0,0 +1,747 @@
+/* Copyright (C) 2005-2017 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * GDSIIReader.cc -- low-level access to the bytes of a GDSII file,
+ *                -- via mmap() where possible and buffered stdio otherwise,
+ *                -- or from a descriptor or stream, stopping at ENDLIB
+ */
+
+#ifdef HAVE_CONFIG_H
+  #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <string>
+
+#ifdef HAVE_LIBZ
+  #include <zlib.h>
+#endif
+
+#include "GDSIIReader.h"
+
+using namespace std;
+namespace libGDSII {
+
+// initial size of the buffer used for non-mapped input; grown as
+// needed to hold the largest record (at most 64 kB per the spec)
+#define READER_BUFFER_SIZE (1<<20)
+
+/***************************************************************/
+/* A GDSIISource delivers the bytes of a GDSII library from a  */
+/* file descriptor or stream, decompressing them on the fly if */
+/* they start with the gzip signature. Each call returns as    */
+/* soon as any data are available, and the source follows the  */
+/* record structure of what it delivers so that it stops at    */
+/* the end of the ENDLIB record: bytes that follow the library */
+/* in the descriptor or stream are left for the caller to read.*/
+/* Where the descriptor is seekable, input is read in large    */
+/* blocks and any excess is handed back with lseek(); other    */
+/* uncompressed input is read no further than the end of the   */
+/* next record header. Compressed input from an unseekable     */
+/* source may be read up to SOURCE_BUFFER_SIZE bytes beyond    */
+/* the end of the compressed data.                             */
+/***************************************************************/
+#define SOURCE_BUFFER_SIZE (1<<16)
+
+// return values of ReadRaw other than byte counts
+#define RAW_END         0  // end of input, or a read error
+#define RAW_STOPPED    -1  // woken by ClosePipe
+#define RAW_WOULDBLOCK -2  // no data available right now
+
+typedef struct GDSIISource
+ {
+   int FileDescriptor;  // -1 for streams
+   istream *Stream;
+   int WakeFD;          // readable when the source is to stop, or -1
+   bool Seekable;
+   size_t NumAvailable; // bytes known to be waiting in FileDescriptor
+
+   // record structure of the bytes delivered so far
+   BYTE Header[4];
+   int HeaderBytes;     // bytes of the current record header seen
+   size_t BodyBytes;    // bytes of the current record body still to come
+   bool Done;           // ENDLIB delivered, end of input, or error
+
+   // compressed input: Compressed is -1 until the first two bytes
+   // have been seen; InBuffer holds raw input not yet consumed
+   int Compressed;
+   BYTE *InBuffer;
+   size_t NumPending;   // uncompressed bytes waiting in InBuffer
+#ifdef HAVE_LIBZ
+   z_stream ZStream;
+#endif
+
+ } GDSIISource;
+
+static void InitSource(GDSIISource *S, int FileDescriptor, istream *Stream)
+{
+  S->FileDescriptor = FileDescriptor;
+  S->Stream         = Stream;
+  S->WakeFD         = -1;
+  S->Seekable       = (!Stream && lseek(FileDescriptor, 0, SEEK_CUR)!=(off_t)-1);
+  S->NumAvailable   = 0;
+  S->HeaderBytes    = 0;
+  S->BodyBytes      = 0;
+  S->Done           = false;
+  S->Compressed     = -1;
+  S->InBuffer       = 0;
+  S->NumPending     = 0;
+}
+
+static void FreeSource(GDSIISource *S)
+{
+#ifdef HAVE_LIBZ
+  if (S->Compressed==1)
+   inflateEnd(&(S->ZStream));
+#endif
+  free(S->InBuffer);
+}
+
+// number of further bytes that certainly belong to the library:
+// the rest of the current record and the header of the next
+static size_t NumSafeBytes(GDSIISource *S)
+{
+  if (S->HeaderBytes<4)
+   return 4 - S->HeaderBytes;
+  return S->BodyBytes + 4;
+}
+
+// follow the record structure of NumBytes delivered bytes; returns
+// the number of them up to the end of the ENDLIB record
+static size_t TrackRecords(GDSIISource *S, const BYTE *Bytes, size_t NumBytes)
+{
+  size_t n=0;
+  while( n<NumBytes && !S->Done )
+   { if (S->HeaderBytes<4)
+      { S->Header[S->HeaderBytes++] = Bytes[n++];
+        if (S->HeaderBytes<4)
+         continue;
+        size_t RecordSize = (S->Header[0]<<8) | S->Header[1];
+        if (S->Header[2]==RTYPE_ENDLIB || RecordSize<4)
+         S->Done=true; // (invalid records are left to the parser to report)
+        else if ( (S->BodyBytes = RecordSize-4)==0 )
+         S->HeaderBytes=0;
+      }
+     else
+      { size_t NumBody = NumBytes-n < S->BodyBytes ? NumBytes-n : S->BodyBytes;
+        n            += NumBody;
+        S->BodyBytes -= NumBody;
+        if (S->BodyBytes==0)
+         S->HeaderBytes=0;
+      }
+   }
+  return n;
+}
+
+// a single read of at most NumBytes bytes from the underlying
+// descriptor or stream, returning whatever is available
+static ssize_t ReadRaw(GDSIISource *S, BYTE *Bytes, size_t NumBytes, bool NoWait)
+{
+  if (S->Stream)
+   { streamsize NumRead = S->Stream->readsome((char *)Bytes, NumBytes);
+     if (NumRead>0)
+      return NumRead;
+     // nothing buffered: wait for the bytes that must follow (all
+     // of them for uncompressed data, as the caller asks for no more
+     // than the rest of the record; otherwise just one)
+     S->Stream->read((char *)Bytes, S->Compressed==1 ? 1 : NumBytes);
+     return S->Stream->gcount();
+   }
+
+  // unless input is known to be waiting, find out how much there
+  // is (which saves a poll() per record on pipes read record by
+  // record) or wait for some
+  if (S->NumAvailable==0)
+   { int NumAvailable=0;
+     if ( NoWait && ioctl(S->FileDescriptor, FIONREAD, &NumAvailable)==0 )
+      { if (NumAvailable<=0)
+         return RAW_WOULDBLOCK;
+        S->NumAvailable = NumAvailable;
+      }
+     else
+      { struct pollfd Polls[2];
+        Polls[0].fd     = S->FileDescriptor;
+        Polls[0].events = POLLIN;
+        Polls[1].fd     = S->WakeFD;
+        Polls[1].events = POLLIN;
+        int Status;
+        do
+         Status = poll(Polls, S->WakeFD==-1 ? 1 : 2, NoWait ? 0 : -1);
+        while( Status==-1 && errno==EINTR );
+        if (Status==-1)
+         return RAW_END;
+        if (S->WakeFD!=-1 && Polls[1].revents)
+         return RAW_STOPPED;
+        if (Status==0)
+         return RAW_WOULDBLOCK;
+      }
+   }
+
+  ssize_t NumRead;
+  do
+   NumRead = read(S->FileDescriptor, Bytes, NumBytes);
+  while( NumRead==-1 && errno==EINTR );
+  if (NumRead<=0)
+   return RAW_END;
+  S->NumAvailable -= ( (size_t)NumRead < S->NumAvailable ? NumRead : S->NumAvailable );
+  return NumRead;
+}
+
+/***************************************************************/
+/* read up to NumBytes bytes of the library; returns 0 if none */
+/* are available, which is the case only at the end of input   */
+/* (S->Done is then set) or, if NoWait, if reading would block */
+/***************************************************************/
+static size_t ReadFromSource(GDSIISource *S, BYTE *Bytes, size_t NumBytes, bool NoWait)
+{
+  if (S->Done || NumBytes==0)
+   return 0;
+
+  // look at the first two bytes for the gzip signature
+  if (S->Compressed==-1)
+   { if ( !S->InBuffer && !(S->InBuffer = (BYTE *)malloc(SOURCE_BUFFER_SIZE)) )
+      { S->Done=true;
+        return 0;
+      }
+     while( S->NumPending<2 )
+      { ssize_t NumRead = ReadRaw(S, S->InBuffer + S->NumPending, 2 - S->NumPending, false);
+        if (NumRead<=0)
+         break;
+        S->NumPending += NumRead;
+      }
+     S->Compressed = (S->NumPending==2 && S->InBuffer[0]==0x1f && S->InBuffer[1]==0x8b);
+#ifdef HAVE_LIBZ
+     if (S->Compressed)
+      { memset(&(S->ZStream), 0, sizeof(z_stream));
+        if ( inflateInit2(&(S->ZStream), 16+MAX_WBITS)!=Z_OK )
+         { S->Compressed=0;
+           S->Done=true;
+           return 0;
+         }
+        S->ZStream.next_in  = S->InBuffer;
+        S->ZStream.avail_in = S->NumPending;
+        S->NumPending       = 0;
+      }
+#endif
+   }
+
+  size_t NumRead=0;
+#ifdef HAVE_LIBZ
+  if (S->Compressed)
+   { z_stream *Z = &(S->ZStream);
+     Z->next_out  = Bytes;
+     Z->avail_out = NumBytes;
+     while( Z->avail_out==NumBytes )
+      { if (Z->avail_in==0)
+         { ssize_t NumRawBytes = ReadRaw(S, S->InBuffer, SOURCE_BUFFER_SIZE, NoWait);
+           if (NumRawBytes==RAW_WOULDBLOCK)
+            return 0;
+           if (NumRawBytes<=0)
+            { S->Done=true;
+              return 0;
+            }
+           Z->next_in  = S->InBuffer;
+           Z->avail_in = NumRawBytes;
+         }
+        int Status = inflate(Z, Z_NO_FLUSH);
+        if (Status==Z_STREAM_END)
+         inflateReset(Z); // gzip data may consist of several members
+        else if (Status!=Z_OK && Status!=Z_BUF_ERROR)
+         { S->Done=true;
+           return 0;
+         }
+      }
+     NumRead = NumBytes - Z->avail_out;
+     return TrackRecords(S, Bytes, NumRead);
+   }
+#endif
+
+  if (S->NumPending>0)
+   { NumRead = NumBytes < S->NumPending ? NumBytes : S->NumPending;
+     memcpy(Bytes, S->InBuffer, NumRead);
+     memmove(S->InBuffer, S->InBuffer + NumRead, S->NumPending - NumRead);
+     S->NumPending -= NumRead;
+     return TrackRecords(S, Bytes, NumRead);
+   }
+
+  size_t MaxBytes = NumBytes;
+  if (!S->Seekable && MaxBytes > NumSafeBytes(S))
+   MaxBytes = NumSafeBytes(S);
+  ssize_t NumRawBytes = ReadRaw(S, Bytes, MaxBytes, NoWait);
+  if (NumRawBytes==RAW_WOULDBLOCK)
+   return 0;
+  if (NumRawBytes<=0)
+   { S->Done=true;
+     return 0;
+   }
+  NumRead = TrackRecords(S, Bytes, NumRawBytes);
+  if ( NumRead < (size_t)NumRawBytes && S->Seekable )
+   lseek(S->FileDescriptor, NumRead - (off_t)NumRawBytes, SEEK_CUR);
+  return NumRead;
+}
+
+/***************************************************************/
+/* A GDSIIPipe reads a file descriptor on a thread of its own  */
+/* into a ring of chunks, from which the reader takes them in  */
+/* order, so that waiting for input overlaps with decoding     */
+/* records. The reading thread owns the chunk after the last   */
+/* full one; all others belong to the reader. Each chunk is    */
+/* handed over as soon as no more input is immediately         */
+/* available. The thread waits for input in poll() on the      */
+/* descriptor and on a wake-up pipe, so that ClosePipe() can   */
+/* always stop it. Streams offer no such way to interrupt a    */
+/* read in progress, so they are read directly by the reader,  */
+/* on the calling thread.                                      */
+/***************************************************************/
+#define PIPE_CHUNK_SIZE (1<<20)
+#define PIPE_NUM_CHUNKS 4
+
+typedef struct GDSIIPipe
+ {
+   GDSIISource Source;
+   bool Threaded;
+
+   // ring of chunks: NumFull full chunks starting at Chunks[First],
+   // of which the first Consumed bytes have already been taken
+   BYTE *Chunks[PIPE_NUM_CHUNKS];
+   size_t ChunkSizes[PIPE_NUM_CHUNKS];
+   int First, NumFull;
+   size_t Consumed;
+   bool EndOfInput, Closing;
+
+   int WakeFDs[2];
+   pthread_t Thread;
+   pthread_mutex_t Mutex;
+   pthread_cond_t NotEmpty, NotFull;
+
+ } GDSIIPipe;
+
+static void *PipeThread(void *UserData)
+{
+  GDSIIPipe *Pipe = (GDSIIPipe *)UserData;
+  bool Done=false;
+  while(!Done)
+   { 
+     // wait for a free chunk
+     pthread_mutex_lock(&(Pipe->Mutex));
+     while( Pipe->NumFull==PIPE_NUM_CHUNKS && !Pipe->Closing )
+      pthread_cond_wait(&(Pipe->NotFull), &(Pipe->Mutex));
+     int nc = (Pipe->First + Pipe->NumFull) % PIPE_NUM_CHUNKS;
+     Done = Pipe->Closing;
+     pthread_mutex_unlock(&(Pipe->Mutex));
+     if (Done)
+      break;
+
+     // fill it, without holding the lock, with whatever input is
+     // available, waiting only for the first byte
+     size_t NumRead=0;
+     while( NumRead<PIPE_CHUNK_SIZE )
+      { size_t n = ReadFromSource(&(Pipe->Source), Pipe->Chunks[nc] + NumRead,
+                                  PIPE_CHUNK_SIZE - NumRead, NumRead>0);
+        if (n==0)
+         break;
+        NumRead+=n;
+      }
+     Done = Pipe->Source.Done;
+
+     pthread_mutex_lock(&(Pipe->Mutex));
+     if (NumRead>0)
+      { Pipe->ChunkSizes[nc] = NumRead;
+        Pipe->NumFull++;
+      }
+     if (Done)
+      Pipe->EndOfInput = true;
+     pthread_cond_signal(&(Pipe->NotEmpty));
+     pthread_mutex_unlock(&(Pipe->Mutex));
+   }
+  return 0;
+}
+
+// take up to NumBytes bytes from the pipe, waiting if none are
+// available yet; returns 0 only at end of input
+static size_t ReadFromPipe(GDSIIPipe *Pipe, BYTE *Bytes, size_t NumBytes)
+{
+  if (!Pipe->Threaded)
+   { size_t NumRead=0;
+     while( NumRead==0 && !Pipe->Source.Done )
+      NumRead = ReadFromSource(&(Pipe->Source), Bytes, NumBytes, false);
+     return NumRead;
+   }
+
+  pthread_mutex_lock(&(Pipe->Mutex));
+  while( Pipe->NumFull==0 && !Pipe->EndOfInput )
+   pthread_cond_wait(&(Pipe->NotEmpty), &(Pipe->Mutex));
+  bool Empty = (Pipe->NumFull==0);
+  pthread_mutex_unlock(&(Pipe->Mutex));
+  if (Empty)
+   return 0;
+
+  int nc = Pipe->First;
+  size_t Available = Pipe->ChunkSizes[nc] - Pipe->Consumed;
+  if (NumBytes > Available)
+   NumBytes = Available;
+  memcpy(Bytes, Pipe->Chunks[nc] + Pipe->Consumed, NumBytes);
+  Pipe->Consumed += NumBytes;
+
+  // hand the chunk back to the reading thread once it is used up
+  if (Pipe->Consumed == Pipe->ChunkSizes[nc])
+   { pthread_mutex_lock(&(Pipe->Mutex));
+     Pipe->First = (Pipe->First + 1) % PIPE_NUM_CHUNKS;
+     Pipe->NumFull--;
+     Pipe->Consumed = 0;
+     pthread_cond_signal(&(Pipe->NotFull));
+     pthread_mutex_unlock(&(Pipe->Mutex));
+   }
+  return NumBytes;
+}
+
+static void FreePipe(GDSIIPipe *Pipe)
+{
+  FreeSource(&(Pipe->Source));
+  for(int nc=0; nc<PIPE_NUM_CHUNKS; nc++)
+   free(Pipe->Chunks[nc]);
+  for(int n=0; n<2; n++)
+   if (Pipe->WakeFDs[n]!=-1)
+    close(Pipe->WakeFDs[n]);
+  pthread_mutex_destroy(&(Pipe->Mutex));
+  pthread_cond_destroy(&(Pipe->NotEmpty));
+  pthread_cond_destroy(&(Pipe->NotFull));
+  delete Pipe;
+}
+
+// stop the reading thread, wherever it is waiting, and free the pipe
+static void ClosePipe(GDSIIPipe *Pipe)
+{
+  if (Pipe->Threaded)
+   { pthread_mutex_lock(&(Pipe->Mutex));
+     Pipe->Closing = true;
+     pthread_cond_signal(&(Pipe->NotFull));
+     pthread_mutex_unlock(&(Pipe->Mutex));
+     BYTE Wake=0;
+     while( write(Pipe->WakeFDs[1], &Wake, 1)==-1 && errno==EINTR )
+      ;
+     pthread_join(Pipe->Thread, 0);
+   }
+  FreePipe(Pipe);
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+GDSIIReader::GDSIIReader()
+{
+  Data       = 0;
+  DataSize   = 0;
+  Position   = 0;
+  FileOffset = 0;
+  MappedData = 0;
+  MappedSize = 0;
+  InMemory   = false;
+  f          = 0;
+  GZFile     = 0;
+  Pipe       = 0;
+  Buffer     = 0;
+  BufferSize = 0;
+}
+
+GDSIIReader::~GDSIIReader()
+{ Close(); }
+
+void GDSIIReader::Close()
+{
+  if (MappedData)
+   munmap(MappedData, MappedSize);
+  if (f)
+   fclose(f);
+#ifdef HAVE_LIBZ
+  if (GZFile)
+   gzclose((gzFile)GZFile);
+#endif
+  if (Pipe)
+   ClosePipe(Pipe);
+  if (Buffer)
+   free(Buffer);
+
+  Data       = 0;
+  DataSize   = 0;
+  Position   = 0;
+  FileOffset = 0;
+  MappedData = 0;
+  MappedSize = 0;
+  InMemory   = false;
+  f          = 0;
+  GZFile     = 0;
+  Pipe       = 0;
+  Buffer     = 0;
+  BufferSize = 0;
+}
+
+/***************************************************************/
+/* check for the two-byte signature of gzip-compressed data    */
+/***************************************************************/
+static bool IsGzipFile(const char *FileName)
+{
+  FILE *f=fopen(FileName,"r");
+  if (!f) return false;
+  BYTE Magic[2];
+  bool IsGzip = ( fread(Magic, 1, 2, f)==2 && Magic[0]==0x1f && Magic[1]==0x8b );
+  fclose(f);
+  return IsGzip;
+}
+
+/***************************************************************/
+/* try to map the whole file into memory; if that fails for    */
+/* any reason (empty file, pipe, etc.) fall back to reading it */
+/* through a buffer                                            */
+/***************************************************************/
+string *GDSIIReader::Open(const char *FileName)
+{
+  Close();
+
+  if ( IsGzipFile(FileName) )
+   {
+#ifdef HAVE_LIBZ
+     gzFile gz = gzopen(FileName, "rb");
+     if (!gz)
+      return new string(string("could not open ") + FileName);
+     gzbuffer(gz, READER_BUFFER_SIZE);
+     GZFile     = gz;
+     BufferSize = READER_BUFFER_SIZE;
+     Buffer     = (BYTE *)malloc(BufferSize);
+     if (!Buffer)
+      return new string("out of memory");
+     Data = Buffer;
+     return 0;
+#else
+     return new string(string(FileName) + " is compressed, but libGDSII was built without zlib");
+#endif
+   }
+
+  if ( getenv("LIBGDSII_NO_MMAP")==0 )
+   { int fd = open(FileName, O_RDONLY);
+     if (fd==-1)
+      return new string(string("could not open ") + FileName);
+     struct stat FileInfo;
+     if ( fstat(fd, &FileInfo)==0 && S_ISREG(FileInfo.st_mode) && FileInfo.st_size>0 )
+      { void *p = mmap(0, FileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p!=MAP_FAILED)
+         { madvise(p, FileInfo.st_size, MADV_SEQUENTIAL);
+           MappedData = p;
+           MappedSize = FileInfo.st_size;
+           Data       = (const BYTE *)p;
+           DataSize   = MappedSize;
+           InMemory   = true;
+         }
+      }
+     close(fd);
+     if (MappedData)
+      return 0;
+   }
+
+  f=fopen(FileName,"r");
+  if (!f)
+   return new string(string("could not open ") + FileName);
+  BufferSize = READER_BUFFER_SIZE;
+  Buffer     = (BYTE *)malloc(BufferSize);
+  if (!Buffer)
+   return new string("out of memory");
+  Data = Buffer;
+  return 0;
+}
+
+void GDSIIReader::Open(const BYTE *Bytes, size_t Size, size_t Offset)
+{
+  Close();
+  Data       = Bytes;
+  DataSize   = Size;
+  FileOffset = Offset;
+  InMemory   = true;
+}
+
+/***************************************************************/
+/* start a background thread reading from a file descriptor    */
+/* (if Stream is null), or prepare to read from a stream       */
+/***************************************************************/
+string *GDSIIReader::OpenPipe(int FileDescriptor, istream *Stream)
+{
+  Close();
+
+  GDSIIPipe *NewPipe  = new GDSIIPipe;
+  InitSource(&(NewPipe->Source), FileDescriptor, Stream);
+  NewPipe->Threaded   = (Stream==0);
+  NewPipe->First      = 0;
+  NewPipe->NumFull    = 0;
+  NewPipe->Consumed   = 0;
+  NewPipe->EndOfInput = false;
+  NewPipe->Closing    = false;
+  NewPipe->WakeFDs[0] = NewPipe->WakeFDs[1] = -1;
+  for(int nc=0; nc<PIPE_NUM_CHUNKS; nc++)
+   NewPipe->Chunks[nc] = 0;
+  pthread_mutex_init(&(NewPipe->Mutex), 0);
+  pthread_cond_init(&(NewPipe->NotEmpty), 0);
+  pthread_cond_init(&(NewPipe->NotFull), 0);
+  if (NewPipe->Threaded)
+   { bool OK = (pipe(NewPipe->WakeFDs)==0);
+     if (!OK)
+      NewPipe->WakeFDs[0] = NewPipe->WakeFDs[1] = -1;
+     for(int nc=0; nc<PIPE_NUM_CHUNKS; nc++)
+      OK = ( (NewPipe->Chunks[nc] = (BYTE *)malloc(PIPE_CHUNK_SIZE)) ) && OK;
+     NewPipe->Source.WakeFD = NewPipe->WakeFDs[0];
+     if ( !OK || pthread_create(&(NewPipe->Thread), 0, PipeThread, NewPipe)!=0 )
+      { FreePipe(NewPipe);
+        return new string("could not start input thread");
+      }
+   }
+
+  Pipe       = NewPipe;
+  BufferSize = READER_BUFFER_SIZE;
+  Buffer     = (BYTE *)malloc(BufferSize);
+  if (!Buffer)
+   return new string("out of memory");
+  Data = Buffer;
+  return 0;
+}
+
+string *GDSIIReader::Open(int FileDescriptor)
+{ return OpenPipe(FileDescriptor, 0); }
+
+string *GDSIIReader::Open(istream &Stream)
+{ return OpenPipe(-1, &Stream); }
+
+const BYTE *GDSIIReader::GetBytes(size_t *Size)
+{
+  if (!InMemory) return 0;
+  *Size = DataSize;
+  return Data;
+}
+
+/***************************************************************/
+/* read up to NumBytes bytes from the underlying file; returns */
+/* the number of bytes read, which is 0 at end of file or on   */
+/* error                                                       */
+/***************************************************************/
+size_t GDSIIReader::ReadBytes(BYTE *Bytes, size_t NumBytes)
+{
+  if (Pipe)
+   return ReadFromPipe(Pipe, Bytes, NumBytes);
+#ifdef HAVE_LIBZ
+  if (GZFile)
+   { int NumRead = gzread((gzFile)GZFile, Bytes, (unsigned)NumBytes);
+     return NumRead<0 ? 0 : NumRead;
+   }
+#endif
+  return fread(Bytes, 1, NumBytes, f);
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+const BYTE *GDSIIReader::Peek(size_t NumBytes)
+{
+  if ( Position + NumBytes <= DataSize )
+   return Data + Position;
+
+  if (!f && !GZFile && !Pipe) // in-memory input: no more data
+   return 0;
+
+  // discard any bytes that were skipped past the end of the window
+  if ( Position > DataSize )
+   { FileOffset += DataSize;
+     Position   -= DataSize;
+     DataSize    = 0;
+     while( Position > 0 )
+      { size_t NumToSkip = (Position < BufferSize) ? Position : BufferSize;
+        size_t NumRead   = ReadBytes(Buffer, NumToSkip);
+        if (NumRead==0)
+         return 0;
+        FileOffset += NumRead;
+        Position   -= NumRead;
+      }
+   }
+
+  // slide unread bytes to the front of the buffer, growing it
+  // if necessary, then top it up from the file
+  size_t Remaining = DataSize - Position;
+  if (NumBytes > BufferSize)
+   { BYTE *NewBuffer = (BYTE *)malloc(NumBytes);
+     if (!NewBuffer) return 0;
+     memcpy(NewBuffer, Buffer + Position, Remaining);
+     free(Buffer);
+     Buffer     = NewBuffer;
+     BufferSize = NumBytes;
+   }
+  else if (Remaining>0)
+   memmove(Buffer, Buffer + Position, Remaining);
+  FileOffset += Position;
+  Position    = 0;
+  DataSize    = Remaining;
+  Data        = Buffer;
+
+  while( DataSize < NumBytes )
+   { size_t NumRead = ReadBytes(Buffer + DataSize, BufferSize - DataSize);
+     if (NumRead==0)
+      return 0;
+     DataSize += NumRead;
+   }
+  return Data;
+}
+
+/***************************************************************/
+/***************************************************************/
+/***************************************************************/
+bool GDSIIReader::Seek(size_t Offset)
+{
+  if ( Offset>=FileOffset && Offset-FileOffset<=DataSize )
+   { Position = Offset - FileOffset;
+     return true;
+   }
+  if (!f && !GZFile && !Pipe)
+   return false;
+  if ( Offset>=Tell() )
+   { Skip(Offset - Tell());
+     return true;
+   }
+  if (Pipe)
+   return false;
+#ifdef HAVE_LIBZ
+  // backward seeks in compressed files restart decompression
+  // from the beginning of the file
+  if ( GZFile && gzseek((gzFile)GZFile, Offset, SEEK_SET)!=(z_off_t)Offset )
+   return false;
+#endif
+  if ( f && fseek(f, Offset, SEEK_SET)!=0 )
+   return false;
+  FileOffset = Offset;
+  Position   = 0;
+  DataSize   = 0;
+  return true;
+}
+
+} // namespace libGDSII
@@ -0,0 +1,261 @@
+/* Copyright (C) 2005-2017 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * GDSIIReader.h -- internal definitions for the low-level GDSII
+ *               -- record reader (not installed)
+ */
+#ifndef GDSIIREADER_H
+#define GDSIIREADER_H
+
+#include <stdio.h>
+#include <string>
+#include <istream>
+#include <vector>
+
+#include "libGDSII.h"
+
+namespace libGDSII {
+
+typedef unsigned char  BYTE;
+typedef unsigned short WORD;
+typedef unsigned long  DWORD;
+
+/***************************************************************/
+/* table of GDSII data types ***********************************/
+/***************************************************************/
+enum DataType{ NO_DATA,    // 0x00
+               BITARRAY,   // 0x01
+               INTEGER_2,  // 0x02
+               INTEGER_4,  // 0x03
+               REAL_4,     // 0x04
+               REAL_8,     // 0x05
+               STRING      // 0x06
+              };
+
+/*--------------------------------------------------------------*/
+/* a single data record in the GDSII file. The record does not  */
+/* own its payload: Payload points directly into the bytes held */
+/* by the GDSIIReader it came from and remains valid until the  */
+/* next record is read. Values are decoded on demand by the     */
+/* GetRecord* routines below.                                   */
+/*--------------------------------------------------------------*/
+typedef struct GDSIIRecord
+ {
+   BYTE RType;          // record type
+   BYTE DType;          // data type
+   const BYTE *Payload; // raw big-endian payload bytes
+   size_t PayloadSize;
+   size_t NumVals;
+
+ } GDSIIRecord;
+
+/***************************************************************/
+/* GDSIIReader presents the bytes of a GDSII file as a         */
+/* contiguous window from which records are decoded in place.  */
+/* If possible the whole file is mmap()ed, in which case no    */
+/* data are ever copied; otherwise (or if the environment      */
+/* variable LIBGDSII_NO_MMAP is set) the file is read through  */
+/* a single reusable buffer that always holds at least one     */
+/* complete record. Gzip-compressed files are decompressed on  */
+/* the fly into the same buffer (if libGDSII was built with    */
+/* zlib). Input from file descriptors, which need not be       */
+/* seekable, is read ahead by a background thread (see         */
+/* GDSIIPipe) while records are being decoded; streams are     */
+/* read on the calling thread. Both deliver data as soon as it */
+/* arrives and stop at the end of the ENDLIB record.           */
+/***************************************************************/
+typedef struct GDSIIPipe GDSIIPipe;
+
+class GDSIIReader
+ {
+   public:
+     GDSIIReader();
+     ~GDSIIReader();
+
+     // returns 0 on success or an error message on failure
+     std::string *Open(const char *FileName);
+
+     // read from a block of Size bytes already in memory, which must
+     // remain valid until the reader is closed; FileOffset is the file
+     // offset of Bytes[0], as reported by Tell()
+     void Open(const BYTE *Bytes, size_t Size, size_t FileOffset=0);
+
+     // read from a file descriptor (e.g. stdin or a pipe) or an input
+     // stream, neither of which is closed by the reader; reading stops
+     // after the ENDLIB record, so any data that follow the library
+     // remain to be read by the caller (but see GDSIISource for
+     // compressed data). Only forward seeks are possible. Return 0 on
+     // success or an error message.
+     std::string *Open(int FileDescriptor);
+     std::string *Open(std::istream &Stream);
+
+     void Close();
+
+     // if the entire input is available in memory (mapped file or
+     // memory block), return a pointer to it and set *Size
+     const BYTE *GetBytes(size_t *Size);
+
+     // return a pointer to the next NumBytes bytes of input,
+     // contiguous in memory, without consuming them; returns 0 if
+     // fewer than NumBytes bytes remain
+     const BYTE *Peek(size_t NumBytes);
+
+     // consume NumBytes bytes of input; bytes skipped beyond the
+     // current window are discarded by the next call to Peek()
+     void Skip(size_t NumBytes) { Position+=NumBytes; }
+
+     // byte offset of the next unread byte from the start of the file
+     size_t Tell() { return FileOffset + Position; }
+
+     // reposition the reader at the given file offset; returns false
+     // if this is not possible
+     bool Seek(size_t Offset);
+
+   private:
+     const BYTE *Data;    // window of file bytes (mapped or buffered)
+     size_t DataSize;     // number of valid bytes in the window
+     size_t Position;     // offset of next unread byte within the window
+     size_t FileOffset;   // file offset of Data[0]
+
+     // memory-mapped input
+     void *MappedData;
+     size_t MappedSize;
+
+     // true if Data holds the entire input
+     bool InMemory;
+
+     // buffered input, from f, (for compressed files) GZFile, or Pipe
+     FILE *f;
+     void *GZFile;
+     GDSIIPipe *Pipe;
+     BYTE *Buffer;
+     size_t BufferSize;
+
+     std::string *OpenPipe(int FileDescriptor, std::istream *Stream);
+     size_t ReadBytes(BYTE *Bytes, size_t NumBytes);
+ };
+
+/***************************************************************/
+/* record-level routines (ReadGDSIIFile.cc) ********************/
+/***************************************************************/
+std::string *ReadGDSIIRecord(GDSIIReader *Reader, GDSIIRecord *Record);
+bool PeekGDSIIRecordHeader(GDSIIReader *Reader, size_t *RecordSize, int *RType);
+const char *GetRecordTypeName(int RType);
+
+int ConvertInt(const BYTE *Bytes, DataType DType);
+double ConvertReal(const BYTE *Bytes, DataType DType);
+
+int GetRecordInt(const GDSIIRecord *Record, size_t n);
+double GetRecordReal(const GDSIIRecord *Record, size_t n);
+bool GetRecordBit(const GDSIIRecord *Record, int nf);
+const char *GetRecordString(const GDSIIRecord *Record, char Buffer[33]);
+
+// content hash of a block of bytes, continuing from Hash
+#define GDSII_HASH_SEED 0xCBF29CE484222325ULL
+unsigned long long HashGDSIIBytes(unsigned long long Hash, const BYTE *Bytes, size_t NumBytes);
+
+// content hash of a record with the given 4-byte header, continuing from Hash
+unsigned long long HashGDSIIRecord(unsigned long long Hash, const BYTE *Header,
+                                   const BYTE *Payload, size_t PayloadSize);
+
+/***************************************************************/
+/* index a GDSII file and, if StructHashes is non-null, hash   */
+/* its library header and structures in the same pass          */
+/* (GDSIIIndex.cc)                                             */
+/***************************************************************/
+std::string *IndexGDSIIFile(const char *GDSIIFileName, GDSIIIndex *Index,
+                            unsigned long long *HeaderHash,
+                            std::vector<unsigned long long> *StructHashes);
+
+/***************************************************************/
+/* bulk decoding of record payloads (GDSIIDecode.cc); integer  */
+/* arrays are byte-swapped with the fastest SIMD instructions  */
+/* supported by the host CPU, as determined at run time        */
+/***************************************************************/
+void DecodeInteger4Array(const BYTE *Bytes, int *Values, size_t NumValues);
+void DecodeReal8Array(const BYTE *Bytes, double *Values, size_t NumValues);
+double DecodeReal(const BYTE *Bytes, int NumMantissaBytes);
+
+/***************************************************************/
+/* record types ************************************************/
+/***************************************************************/
+#define RTYPE_HEADER		0x00
+#define RTYPE_BGNLIB		0x01
+#define RTYPE_LIBNAME		0x02
+#define RTYPE_UNITS		0x03
+#define RTYPE_ENDLIB		0x04
+#define RTYPE_BGNSTR		0x05
+#define RTYPE_STRNAME		0x06
+#define RTYPE_ENDSTR		0x07
+#define RTYPE_BOUNDARY		0x08
+#define RTYPE_PATH		0x09
+#define RTYPE_SREF		0x0a
+#define RTYPE_AREF		0x0b
+#define RTYPE_TEXT		0x0c
+#define RTYPE_LAYER		0x0d
+#define RTYPE_DATATYPE		0x0e
+#define RTYPE_WIDTH		0x0f
+#define RTYPE_XY		0x10
+#define RTYPE_ENDEL		0x11
+#define RTYPE_SNAME		0x12
+#define RTYPE_COLROW		0x13
+#define RTYPE_TEXTNODE		0x14
+#define RTYPE_NODE		0x15
+#define RTYPE_TEXTTYPE		0x16
+#define RTYPE_PRESENTATION	0x17
+#define RTYPE_UNUSED		0x18
+#define RTYPE_STRING		0x19
+#define RTYPE_STRANS		0x1a
+#define RTYPE_MAG		0x1b
+#define RTYPE_ANGLE		0x1c
+#define RTYPE_UNUSED2		0x1d
+#define RTYPE_UNUSED3		0x1e
+#define RTYPE_REFLIBS		0x1f
+#define RTYPE_FONTS		0x20
+#define RTYPE_PATHTYPE		0x21
+#define RTYPE_GENERATIONS	0x22
+#define RTYPE_ATTRTABLE		0x23
+#define RTYPE_STYPTABLE		0x24
+#define RTYPE_STRTYPE		0x25
+#define RTYPE_ELFLAGS		0x26
+#define RTYPE_ELKEY		0x27
+#define RTYPE_LINKTYPE		0x1d
+#define RTYPE_LINKKEYS		0x1e
+#define RTYPE_NODETYPE		0x2a
+#define RTYPE_PROPATTR		0x2b
+#define RTYPE_PROPVALUE		0x2c
+#define RTYPE_BOX		0x2d
+#define RTYPE_BOXTYPE		0x2e
+#define RTYPE_PLEX		0x2f
+#define RTYPE_BGNEXTN		0x30
+#define RTYPE_ENDTEXTN		0x31
+#define RTYPE_TAPENUM		0x32
+#define RTYPE_TAPECODE		0x33
+#define RTYPE_STRCLASS		0x34
+#define RTYPE_RESERVED		0x35
+#define RTYPE_FORMAT		0x36
+#define RTYPE_MASK		0x37
+#define RTYPE_ENDMASKS		0x38
+#define RTYPE_LIBDIRSIZE	0x39
+#define RTYPE_SRFNAME		0x3a
+#define RTYPE_LIBSECUR		0x3b
+#define MAX_RTYPE     		0x3b
+
+} // namespace libGDSII
+
+#endif // GDSIIREADER_H
@@ -24,48 +24,73 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <limits.h>
 
 #include <string>
 #include <sstream>
+#include <map>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "libGDSII.h"
+#include "GDSIIReader.h"
+#include "GDSIIArena.h"
 
 using namespace std;
 namespace libGDSII {
 
-typedef unsigned char  BYTE;
-typedef unsigned short WORD;
-typedef unsigned long  DWORD;
-
 /***************************************************************/
 /* some data structures used in this file only *****************/
 /***************************************************************/
 
-/*--------------------------------------------------------------*/
-/* storage for a single data record in the GDSII file           */
-/*--------------------------------------------------------------*/
-typedef struct GDSIIRecord
- {
-   BYTE RType; // record type
-
-   // could use a union for the following, but I don't bother
-   bool Bits[16];
-   iVec iVal;
-   dVec dVal;
-   string *sVal;
-   size_t NumVals;
-
- } GDSIIRecord;
-
 /*--------------------------------------------------------------*/
 /*- 'ParseState' data structure maintained while reading .GDSII */
 /*- file, updated after each record is read                     */
+/*-                                                             */
+/*- If Structs is non-null, the structures and elements read    */
+/*- from the file are stored in it; library-level information   */
+/*- (name, units) is stored in Data if that is non-null. If     */
+/*- Visitor is non-null, events are reported to it as records   */
+/*- are processed. In streaming mode (Structs==0),              */
+/*- CurrentStruct and CurrentElement point to the scratch       */
+/*- objects below, which are recycled for each new struct or    */
+/*- element, and XY and property data are passed to the visitor */
+/*- without being stored anywhere.                              */
 /*--------------------------------------------------------------*/
 class GDSIIData; // forward reference 
 typedef struct ParseState 
  { 
    GDSIIData *Data;
+   GDSIIVisitor *Visitor;
    int NumRecords;
+
+   // containers receiving new structures and layer indices; these
+   // point into Data by default, but may be redirected to private
+   // storage (e.g. when structures are parsed in parallel)
+   vector<GDSIIStruct *> *Structs;
+   set<int> *LayerSet;
+
+   // storage for new elements; must be set if Structs is non-null
+   GDSIIArena *Arena;
+
+   // layer and datatype filters (from Data->ReadOptions); elements
+   // excluded by the filters are marked by SkipElement and dropped
+   // at ENDEL
+   const GDSIIReadOptions *Options;
+   bool SkipElement;
+
+   // if StructHashes is non-null, the hash of each structure is
+   // appended to it as the structure is read, and the hash of the
+   // library header (the records before the first structure) is
+   // stored in *HeaderHash
+   vector<unsigned long long> *StructHashes;
+   unsigned long long *HeaderHash;
+   unsigned long long Hash; // of the records of the header or structure being read
+   bool InHeader;
+
    enum { INITIAL,
           INHEADER,  INLIB,  INSTRUCT, INELEMENT,
           DONE
@@ -73,9 +98,16 @@ typedef struct ParseState
    GDSIIStruct *CurrentStruct;
    GDSIIElement *CurrentElement;
 
+   // storage used in streaming mode only
+   GDSIIStruct ScratchStruct;
+   GDSIIElement ScratchElement;
+   string ScratchSName, ScratchText;
+   iVec XYBuffer;
+   int PropAttr;
+
  } ParseState;
 
-typedef string *(*RecordHandler)(GDSIIRecord Record, ParseState *PState);
+typedef string *(*RecordHandler)(GDSIIRecord *Record, ParseState *PState);
 
 const char *ElTypeNames[]=
  {"BOUNDARY", "PATH", "SREF", "AREF", "TEXT", "NODE", "BOX"};
@@ -83,7 +115,7 @@ const char *ElTypeNames[]=
 /***************************************************************/
 /* Handlers for specific types of data records in GDSII files. */
 /***************************************************************/
-string *handleHEADER(GDSIIRecord Record, ParseState *PState)
+string *handleHEADER(GDSIIRecord *Record, ParseState *PState)
 {
   (void) Record;
   if (PState->Status!=ParseState::INITIAL)
@@ -92,7 +124,7 @@ string *handleHEADER(GDSIIRecord Record, ParseState *PState)
   return 0;
 }
 
-string *handleBGNLIB(GDSIIRecord Record, ParseState *PState)
+string *handleBGNLIB(GDSIIRecord *Record, ParseState *PState)
 {
   (void) Record;
   if (PState->Status!=ParseState::INHEADER)
@@ -101,77 +133,105 @@ string *handleBGNLIB(GDSIIRecord Record, ParseState *PState)
   return 0;
 }
 
-string *handleLIBNAME(GDSIIRecord Record, ParseState *PState)
+string *handleLIBNAME(GDSIIRecord *Record, ParseState *PState)
 { 
   if (PState->Status!=ParseState::INLIB)
    return new string("unexpected record LIBNAME");
-  PState->Data->LibName = new string( *(Record.sVal) );
+  char Buffer[33];
+  const char *LibName = GetRecordString(Record, Buffer);
+  if (PState->Data)
+   PState->Data->LibName = new string(LibName);
+  if (PState->Visitor)
+   PState->Visitor->BeginLibrary(LibName);
   return 0;
 }
 
-string *handleUNITS(GDSIIRecord Record, ParseState *PState)
+string *handleUNITS(GDSIIRecord *Record, ParseState *PState)
 { 
-  PState->Data->FileUnits[0] = Record.dVal[0];
-  PState->Data->FileUnits[1] = Record.dVal[1];
-  PState->Data->UnitInMeters =
-   PState->Data->FileUnits[1] / PState->Data->FileUnits[0];
+  double Units[2];
+  if (Record->DType==REAL_8 && Record->NumVals==2)
+   DecodeReal8Array(Record->Payload, Units, 2);
+  else
+   { Units[0] = GetRecordReal(Record, 0);
+     Units[1] = GetRecordReal(Record, 1);
+   }
+  double UserUnit = Units[0], MeterUnit = Units[1];
+  if (PState->Data)
+   { PState->Data->FileUnits[0] = UserUnit;
+     PState->Data->FileUnits[1] = MeterUnit;
+     PState->Data->UnitInMeters = MeterUnit / UserUnit;
+   }
+  if (PState->Visitor)
+   PState->Visitor->Units(UserUnit, MeterUnit);
   return 0;
 }
 
-string *handleENDLIB(GDSIIRecord Record, ParseState *PState)
+string *handleENDLIB(GDSIIRecord *Record, ParseState *PState)
 { 
   (void) Record;
   if (PState->Status!=ParseState::INLIB)
    return new string("unexpected record ENDLIB");
   PState->Status=ParseState::DONE;
+  if (PState->Visitor)
+   PState->Visitor->EndLibrary();
   return 0;
 }
 
-string *handleBGNSTR(GDSIIRecord Record, ParseState *PState)
+string *handleBGNSTR(GDSIIRecord *Record, ParseState *PState)
 {
   (void) Record;
   if (PState->Status!=ParseState::INLIB)
    return new string("unexpected record BGNSTR");
 
   // add a new structure
-  GDSIIStruct *s  = new GDSIIStruct;
+  GDSIIStruct *s  = PState->Structs ? new GDSIIStruct : &(PState->ScratchStruct);
   s->IsReferenced = false;
   s->IsPCell      = false;
+  s->Name         = 0;
+  s->Arena        = 0;
   PState->CurrentStruct = s;
-  PState->Data->Structs.push_back(s);
+  if (PState->Structs)
+   PState->Structs->push_back(s);
 
   PState->Status=ParseState::INSTRUCT;
 
   return 0;
 }
 
-string *handleSTRNAME(GDSIIRecord Record, ParseState *PState)
+string *handleSTRNAME(GDSIIRecord *Record, ParseState *PState)
 {
   if (PState->Status!=ParseState::INSTRUCT)
    return new string("unexpected record STRNAME");
-  PState->CurrentStruct->Name = new string( *(Record.sVal) );
-  if( strcasestr( Record.sVal->c_str(), "CONTEXT_INFO") )
+  char Buffer[33];
+  const char *Name = GetRecordString(Record, Buffer);
+  if (PState->Structs)
+   PState->CurrentStruct->Name = new string(Name);
+  if( strcasestr(Name, "CONTEXT_INFO") )
    PState->CurrentStruct->IsPCell=true;
+  if (PState->Visitor)
+   PState->Visitor->BeginStruct(Name);
   return 0;
 }
 
-string *handleENDSTR(GDSIIRecord Record, ParseState *PState)
+string *handleENDSTR(GDSIIRecord *Record, ParseState *PState)
 {
   (void) Record;
   if (PState->Status!=ParseState::INSTRUCT)
    return new string("unexpected record ENDSTR");
   PState->Status=ParseState::INLIB;
+  if (PState->Visitor)
+   PState->Visitor->EndStruct();
   return 0;
 }
 
-string *handleElement(GDSIIRecord Record, ParseState *PState, ElementType ElType)
+string *handleElement(GDSIIRecord *Record, ParseState *PState, ElementType ElType)
 {
   (void) Record;
   if (PState->Status!=ParseState::INSTRUCT)
    return new string(   string("unexpected record") + ElTypeNames[ElType] );
   
   // add a new element
-  GDSIIElement *e = new GDSIIElement;
+  GDSIIElement *e = PState->Structs ? PState->Arena->NewElement() : &(PState->ScratchElement);
   e->Type     = ElType;
   e->Layer    = 0;
   e->DataType = 0;
@@ -189,185 +249,258 @@ string *handleElement(GDSIIRecord Record, ParseState *PState, ElementType ElType
   e->Angle    = 0.0;
   e->nsRef    = -1;
   PState->CurrentElement = e;
-  PState->CurrentStruct->Elements.push_back(e);
+  if (PState->Structs)
+   PState->CurrentStruct->Elements.push_back(e);
+  else
+   { e->XY.Values=0;
+     e->XY.Size=0;
+     e->PropAttrs.clear();
+     e->PropValues.clear();
+   }
+  PState->PropAttr = -1;
+  PState->SkipElement = false;
 
   PState->Status=ParseState::INELEMENT;
+  if (PState->Visitor)
+   PState->Visitor->BeginElement(ElType);
   return 0;
 }
 
-string *handleBOUNDARY(GDSIIRecord Record, ParseState *PState)
+string *handleBOUNDARY(GDSIIRecord *Record, ParseState *PState)
 { return handleElement(Record, PState, BOUNDARY); }
 
-string *handlePATH(GDSIIRecord Record, ParseState *PState)
+string *handlePATH(GDSIIRecord *Record, ParseState *PState)
 { return handleElement(Record, PState, PATH); }
 
-string *handleSREF(GDSIIRecord Record, ParseState *PState)
+string *handleSREF(GDSIIRecord *Record, ParseState *PState)
 { return handleElement(Record, PState, SREF); }
 
-string *handleAREF(GDSIIRecord Record, ParseState *PState)
+string *handleAREF(GDSIIRecord *Record, ParseState *PState)
 { return handleElement(Record, PState, AREF); }
 
-string *handleTEXT(GDSIIRecord Record, ParseState *PState)
+string *handleTEXT(GDSIIRecord *Record, ParseState *PState)
 { return handleElement(Record, PState, TEXT); }
 
-string *handleNODE(GDSIIRecord Record, ParseState *PState)
+string *handleNODE(GDSIIRecord *Record, ParseState *PState)
 { return handleElement(Record, PState, NODE); }
 
-string *handleBOX(GDSIIRecord Record, ParseState *PState)
+string *handleBOX(GDSIIRecord *Record, ParseState *PState)
 { return handleElement(Record, PState, BOX); }
 
-string *handleLAYER(GDSIIRecord Record, ParseState *PState)
+string *handleLAYER(GDSIIRecord *Record, ParseState *PState)
 {
   if (PState->Status!=ParseState::INELEMENT)
    return new string("unexpected record LAYER");
-  PState->CurrentElement->Layer = Record.iVal[0];
-  PState->Data->LayerSet.insert(Record.iVal[0]);
-  
+  int Layer = GetRecordInt(Record, 0);
+  PState->CurrentElement->Layer = Layer;
+  if (PState->Visitor)
+   PState->Visitor->Layer(Layer);
+
   return 0;
 }
 
-string *handleDATATYPE(GDSIIRecord Record, ParseState *PState)
+string *handleDATATYPE(GDSIIRecord *Record, ParseState *PState)
 {
   if (PState->Status!=ParseState::INELEMENT)
    return new string("unexpected record DATATYPE");
-  PState->CurrentElement->DataType = Record.iVal[0];
+  PState->CurrentElement->DataType = GetRecordInt(Record, 0);
   return 0;
 }
 
-string *handleTEXTTYPE(GDSIIRecord Record, ParseState *PState)
+string *handleTEXTTYPE(GDSIIRecord *Record, ParseState *PState)
 { 
   if (    PState->Status!=ParseState::INELEMENT
        || PState->CurrentElement->Type!=TEXT
      )
    return new string("unexpected record TEXTTYPE");
-  PState->CurrentElement->TextType = Record.iVal[0];
+  PState->CurrentElement->TextType = GetRecordInt(Record, 0);
   return 0;
 }
 
-string *handlePATHTYPE(GDSIIRecord Record, ParseState *PState)
+string *handlePATHTYPE(GDSIIRecord *Record, ParseState *PState)
 { 
   if (    PState->Status!=ParseState::INELEMENT )
    return new string("unexpected record PATHTYPE");
-  PState->CurrentElement->PathType = Record.iVal[0];
+  PState->CurrentElement->PathType = GetRecordInt(Record, 0);
   return 0;
 }
 
-string *handleSTRANS(GDSIIRecord Record, ParseState *PState)
+string *handleSTRANS(GDSIIRecord *Record, ParseState *PState)
 { 
   if ( PState->Status!=ParseState::INELEMENT )
    return new string("unexpected record STRANS");
-  PState->CurrentElement->Refl     = Record.Bits[0];
-  PState->CurrentElement->AbsMag   = Record.Bits[13];
-  PState->CurrentElement->AbsAngle = Record.Bits[14];
+  PState->CurrentElement->Refl     = GetRecordBit(Record, 0);
+  PState->CurrentElement->AbsMag   = GetRecordBit(Record, 13);
+  PState->CurrentElement->AbsAngle = GetRecordBit(Record, 14);
   return 0;
 }
 
-string *handleMAG(GDSIIRecord Record, ParseState *PState)
+string *handleMAG(GDSIIRecord *Record, ParseState *PState)
 { 
   if ( PState->Status!=ParseState::INELEMENT )
    return new string("unexpected record MAG");
-  PState->CurrentElement->Mag = Record.dVal[0];
+  PState->CurrentElement->Mag = GetRecordReal(Record, 0);
   return 0;
 }
 
-string *handleANGLE(GDSIIRecord Record, ParseState *PState)
+string *handleANGLE(GDSIIRecord *Record, ParseState *PState)
 { 
   if ( PState->Status!=ParseState::INELEMENT )
    return new string("unexpected record ANGLE");
-  PState->CurrentElement->Angle = Record.dVal[0];
+  PState->CurrentElement->Angle = GetRecordReal(Record, 0);
   return 0;
 }
 
-string *handlePROPATTR(GDSIIRecord Record, ParseState *PState)
+string *handlePROPATTR(GDSIIRecord *Record, ParseState *PState)
 { 
   if ( PState->Status!=ParseState::INELEMENT )
    return new string("unexpected record PROPATTR");
   GDSIIElement *e=PState->CurrentElement;
-  e->PropAttrs.push_back(Record.iVal[0]);
-  e->PropValues.push_back("");
+  int Attr = GetRecordInt(Record, 0);
+  if (PState->Structs)
+   { e->PropAttrs.push_back(Attr);
+     e->PropValues.push_back("");
+   }
+  PState->PropAttr = Attr;
   return 0;
 }
 
-string *handlePROPVALUE(GDSIIRecord Record, ParseState *PState)
+string *handlePROPVALUE(GDSIIRecord *Record, ParseState *PState)
 {
   if ( PState->Status!=ParseState::INELEMENT )
    return new string("unexpected record PROPVALUE");
   GDSIIElement *e=PState->CurrentElement;
-  int n=e->PropAttrs.size();
-  if (n==0)
+  if (PState->PropAttr==-1)
    return new string("PROPVALUE without PROPATTR");
-  e->PropValues[n-1]=string( *(Record.sVal) );
+  char Buffer[33];
+  const char *Value = GetRecordString(Record, Buffer);
+  if (PState->Structs)
+   e->PropValues[e->PropValues.size()-1]=string(Value);
 
-  if( strcasestr( Record.sVal->c_str(), "CONTEXT_INFO") )
+  if( strcasestr(Value, "CONTEXT_INFO") )
    PState->CurrentStruct->IsPCell=true;
 
+  if (PState->Visitor)
+   PState->Visitor->Property(PState->PropAttr, Value);
+
   return 0;
 }
 
-string *handleXY(GDSIIRecord Record, ParseState *PState)
+// true if element e is excluded by the layer/datatype filters in Options
+static bool IsExcluded(const GDSIIReadOptions *Options, const GDSIIElement *e)
+{
+  if (Options==0 || e->Type==SREF || e->Type==AREF)
+   return false;
+  const iVec &Layers = Options->Layers, &DataTypes = Options->DataTypes;
+  if ( Layers.size()>0 && find(Layers.begin(), Layers.end(), e->Layer)==Layers.end() )
+   return true;
+  int DataType = (e->Type==TEXT ? e->TextType : e->DataType);
+  if ( DataTypes.size()>0 && find(DataTypes.begin(), DataTypes.end(), DataType)==DataTypes.end() )
+   return true;
+  return false;
+}
+
+string *handleXY(GDSIIRecord *Record, ParseState *PState)
 {
   if (PState->Status!=ParseState::INELEMENT)
    return new string("unexpected record XY");
-  PState->CurrentElement->XY.reserve(Record.NumVals);
-  for(size_t n=0; n<Record.NumVals; n++)
-   PState->CurrentElement->XY.push_back(Record.iVal[n]);
+  GDSIIElement *e = PState->CurrentElement;
+
+  // by now the layer and datatype of the element are known, so we
+  // can decide whether to keep it before touching its coordinates
+  if ( PState->Structs && IsExcluded(PState->Options, e) )
+   { PState->SkipElement = true;
+     return 0;
+   }
+  if ( PState->LayerSet && e->Type!=SREF && e->Type!=AREF )
+   PState->LayerSet->insert(e->Layer);
+
+  size_t NumVals = Record->NumVals;
+  int *XY;
+  if (PState->Structs)
+   { XY = PState->Arena->NewInts(NumVals);
+     e->XY.Values = XY;
+     e->XY.Size   = NumVals;
+   }
+  else
+   { PState->XYBuffer.resize(NumVals);
+     XY = NumVals ? &(PState->XYBuffer[0]) : 0;
+   }
+  if (Record->DType==INTEGER_4)
+   DecodeInteger4Array(Record->Payload, XY, NumVals);
+  else
+   for(size_t n=0; n<NumVals; n++)
+    XY[n] = GetRecordInt(Record, n);
+  if (PState->Visitor)
+   PState->Visitor->XY(XY, NumVals);
   return 0;
 }
 
-string *handleSNAME(GDSIIRecord Record, ParseState *PState)
+string *handleSNAME(GDSIIRecord *Record, ParseState *PState)
 {
   if (PState->Status!=ParseState::INELEMENT)
    return new string("unexpected record SNAME");
-  PState->CurrentElement->SName = new string( *(Record.sVal) );
+  char Buffer[33];
+  const char *SName = GetRecordString(Record, Buffer);
+  if (PState->Structs)
+   PState->CurrentElement->SName = PState->Arena->Intern(SName);
+  else
+   { PState->ScratchSName = SName;
+     PState->CurrentElement->SName = &(PState->ScratchSName);
+   }
   return 0;
 }
 
-string *handleSTRING(GDSIIRecord Record, ParseState *PState)
+string *handleSTRING(GDSIIRecord *Record, ParseState *PState)
 {
   if (PState->Status!=ParseState::INELEMENT)
    return new string("unexpected record STRING");
-  PState->CurrentElement->Text = new string( *(Record.sVal) );
+  char Buffer[33];
+  const char *Text = GetRecordString(Record, Buffer);
+  if (PState->SkipElement)
+   return 0;
+  if (PState->Structs)
+   PState->CurrentElement->Text = new string(Text);
+  else
+   { PState->ScratchText = Text;
+     PState->CurrentElement->Text = &(PState->ScratchText);
+   }
   return 0;
 }
 
-string *handleCOLROW(GDSIIRecord Record, ParseState *PState)
+string *handleCOLROW(GDSIIRecord *Record, ParseState *PState)
 {
   if (PState->Status!=ParseState::INELEMENT)
    return new string("unexpected record COLROW");
-  PState->CurrentElement->Columns = Record.iVal[0];
-  PState->CurrentElement->Rows    = Record.iVal[1];
+  PState->CurrentElement->Columns = GetRecordInt(Record, 0);
+  PState->CurrentElement->Rows    = GetRecordInt(Record, 1);
   return 0;
 }
 
-string *handleWIDTH(GDSIIRecord Record, ParseState *PState)
+string *handleWIDTH(GDSIIRecord *Record, ParseState *PState)
 {
   if (PState->Status!=ParseState::INELEMENT)
    return new string("unexpected record Width");
-  PState->CurrentElement->Width   = Record.iVal[0];
+  PState->CurrentElement->Width   = GetRecordInt(Record, 0);
   return 0;
 }
 
-string *handleENDEL(GDSIIRecord Record, ParseState *PState)
+string *handleENDEL(GDSIIRecord *Record, ParseState *PState)
 {
   (void) Record;
   if (PState->Status!=ParseState::INELEMENT)
    return new string("unexpected record ENDEL");
   PState->Status = ParseState::INSTRUCT;
+  if (PState->SkipElement)
+   { PState->CurrentStruct->Elements.pop_back();
+     PState->CurrentElement->~GDSIIElement();
+     return 0;
+   }
+  if (PState->Visitor)
+   PState->Visitor->EndElement(PState->CurrentElement);
   return 0;
 }
 
-/***************************************************************/
-/* table of GDSII data types ***********************************/
-/***************************************************************/
-enum DataType{ NO_DATA,    // 0x00
-               BITARRAY,   // 0x01
-               INTEGER_2,  // 0x02
-               INTEGER_4,  // 0x03
-               REAL_4,     // 0x04
-               REAL_8,     // 0x05
-               STRING      // 0x06
-              };
-
 /***************************************************************/
 /* table of GDS record types, gleeped directly from the text of*/
 /* the buchanan email                                          */
@@ -441,139 +574,96 @@ const static RecordType RecordTypes[]={
  /*0x3b*/  {"LIBSECUR",     INTEGER_2,   0}
 };
 
-#define RTYPE_HEADER		0x00
-#define RTYPE_BGNLIB		0x01
-#define RTYPE_LIBNAME		0x02
-#define RTYPE_UNITS		0x03
-#define RTYPE_ENDLIB		0x04
-#define RTYPE_BGNSTR		0x05
-#define RTYPE_STRNAME		0x06
-#define RTYPE_ENDSTR		0x07
-#define RTYPE_BOUNDARY		0x08
-#define RTYPE_PATH		0x09
-#define RTYPE_SREF		0x0a
-#define RTYPE_AREF		0x0b
-#define RTYPE_TEXT		0x0c
-#define RTYPE_LAYER		0x0d
-#define RTYPE_DATATYPE		0x0e
-#define RTYPE_WIDTH		0x0f
-#define RTYPE_XY		0x10
-#define RTYPE_ENDEL		0x11
-#define RTYPE_SNAME		0x12
-#define RTYPE_COLROW		0x13
-#define RTYPE_TEXTNODE		0x14
-#define RTYPE_NODE		0x15
-#define RTYPE_TEXTTYPE		0x16
-#define RTYPE_PRESENTATION	0x17
-#define RTYPE_UNUSED		0x18
-#define RTYPE_STRING		0x19
-#define RTYPE_STRANS		0x1a
-#define RTYPE_MAG		0x1b
-#define RTYPE_ANGLE		0x1c
-#define RTYPE_UNUSED2		0x1d
-#define RTYPE_UNUSED3		0x1e
-#define RTYPE_REFLIBS		0x1f
-#define RTYPE_FONTS		0x20
-#define RTYPE_PATHTYPE		0x21
-#define RTYPE_GENERATIONS	0x22
-#define RTYPE_ATTRTABLE		0x23
-#define RTYPE_STYPTABLE		0x24
-#define RTYPE_STRTYPE		0x25
-#define RTYPE_ELFLAGS		0x26
-#define RTYPE_ELKEY		0x27
-#define RTYPE_LINKTYPE		0x1d
-#define RTYPE_LINKKEYS		0x1e
-#define RTYPE_NODETYPE		0x2a
-#define RTYPE_PROPATTR		0x2b
-#define RTYPE_PROPVALUE		0x2c
-#define RTYPE_BOX		0x2d
-#define RTYPE_BOXTYPE		0x2e
-#define RTYPE_PLEX		0x2f
-#define RTYPE_BGNEXTN		0x30
-#define RTYPE_ENDTEXTN		0x31
-#define RTYPE_TAPENUM		0x32
-#define RTYPE_TAPECODE		0x33
-#define RTYPE_STRCLASS		0x34
-#define RTYPE_RESERVED		0x35
-#define RTYPE_FORMAT		0x36
-#define RTYPE_MASK		0x37
-#define RTYPE_ENDMASKS		0x38
-#define RTYPE_LIBDIRSIZE	0x39
-#define RTYPE_SRFNAME		0x3a
-#define RTYPE_LIBSECUR		0x3b
-#define MAX_RTYPE     		0x3b
 
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
-int ConvertInt(BYTE *Bytes, DataType DType)
+int ConvertInt(const BYTE *Bytes, DataType DType)
 { 
-  unsigned long long i = Bytes[0]*256 + Bytes[1];
-  if (DType==INTEGER_4)
-   i = i*256*256 + Bytes[2]*256 + Bytes[3];
-  if (Bytes[0] & 0x80) // sign bit
-   return -1*( (DType==INTEGER_2 ? 0x010000 : 0x100000000) - i );
+  if (DType==INTEGER_2)
+   return (short)( ((unsigned)Bytes[0]<<8) | Bytes[1] );
+  int i;
+  DecodeInteger4Array(Bytes, &i, 1);
   return i;
 }
 
-double ConvertReal(BYTE *Bytes, DataType DType)
+double ConvertReal(const BYTE *Bytes, DataType DType)
 { 
-  double Sign  = (Bytes[0] & 0x80) ? -1.0 : +1.0;
-  int Exponent = (Bytes[0] & 0x7F) - 64;
-  int NumMantissaBytes = (DType==REAL_4 ? 3 : 7);
-  int NumMantissaBits  = 8*NumMantissaBytes;
-  double Mantissa=0.0;
-  for(int n=0; n<NumMantissaBytes; n++)
-   Mantissa = Mantissa*256 + ((double)(Bytes[1+n]));
-  return Sign * Mantissa * pow(2.0, 4*Exponent - NumMantissaBits);
+  return DecodeReal(Bytes, DType==REAL_4 ? 3 : 7);
 }
 
-
 // The allowed characters are all ASCII-printable characters, including space, except comma (,) and double quote (").
 // Non-allowed characters at the end of the string are removed.
 // Non-allowed characters not at the end of the string are converted to underscores.
 bool IsAllowedChar(char c)
 { return isprint(c) && c!='"' && c!=','; }
 
-string *MakeGDSIIString(char *Original, int Size)
+/***************************************************************/
+/* routines for decoding values directly from the payload of a */
+/* GDSII record                                                */
+/***************************************************************/
+int GetRecordInt(const GDSIIRecord *Record, size_t n)
+{ 
+  size_t DataSize = (Record->DType==INTEGER_2) ? 2 : 4;
+  return ConvertInt(Record->Payload + n*DataSize, (DataType)Record->DType);
+}
+
+double GetRecordReal(const GDSIIRecord *Record, size_t n)
 { 
-  if (Size==0) return new string("");
+  size_t DataSize = (Record->DType==REAL_4) ? 4 : 8;
+  return ConvertReal(Record->Payload + n*DataSize, (DataType)Record->DType);
+}
+
+bool GetRecordBit(const GDSIIRecord *Record, int nf)
+{ 
+  WORD W;
+  memcpy(&W, Record->Payload, sizeof(WORD));
+  return W & (1<<nf);
+}
 
+// copy the (sanitized) string payload of a record into Buffer,
+// which must have room for 33 characters, and return Buffer
+const char *GetRecordString(const GDSIIRecord *Record, char Buffer[33])
+{ 
+  int Size = Record->PayloadSize;
   if (Size>32) Size=32;
-  char RawString[33];
-  strncpy(RawString, Original, Size);
-  RawString[Size]=0;
-  int L = strlen(RawString);
-  while ( L>0 && !IsAllowedChar(RawString[L-1]) )
-   RawString[--L] = 0;
+  strncpy(Buffer, (const char *)Record->Payload, Size);
+  Buffer[Size]=0;
+  int L = strlen(Buffer);
+  while ( L>0 && !IsAllowedChar(Buffer[L-1]) )
+   Buffer[--L] = 0;
   for(int n=0; n<L; n++) 
-   if (!IsAllowedChar(RawString[n])) RawString[n]='_';
-  return new string(RawString);
+   if (!IsAllowedChar(Buffer[n])) Buffer[n]='_';
+  return Buffer;
 }
 
+const char *GetRecordTypeName(int RType)
+{ return RecordTypes[RType].Name; }
+
 /***************************************************************/
-/* read a single GDSII data record from the current file position */
+/* read a single GDSII data record from the current position   */
+/* of Reader. No payload data are copied or decoded here; on   */
+/* return, Record->Payload points into the reader's window.    */
 /***************************************************************/
-GDSIIRecord ReadGDSIIRecord(FILE *f, string **ErrMsg)
+string *ReadGDSIIRecord(GDSIIReader *Reader, GDSIIRecord *Record)
 {
   /*--------------------------------------------------------------*/
   /* read the 4-byte file header and check that the data type     */
   /* agrees with what it should be based on the record type       */
   /*--------------------------------------------------------------*/
-  BYTE Header[4];
-  if ( 4 != fread(Header, 1, 4, f) )
-   { *ErrMsg = new string("unexpected end of file");
-     return GDSIIRecord(); // end of file
-   }
+  const BYTE *Header = Reader->Peek(4);
+  if (!Header)
+   return new string("unexpected end of file");
 
   size_t RecordSize = Header[0]*256 + Header[1];
   BYTE RType        = Header[2];
   BYTE DType        = Header[3];
   
   if (RType > MAX_RTYPE)
-   { *ErrMsg = new string("unknown record type");
-     return GDSIIRecord();
-   }
+   return new string("unknown record type");
+
+  if (RecordSize < 4)
+   return new string("invalid record size");
     
   if ( DType != RecordTypes[RType].DType )
    { ostringstream ss;
@@ -583,126 +673,106 @@ GDSIIRecord ReadGDSIIRecord(FILE *f, string **ErrMsg)
         << " != "
         << RecordTypes[RType].DType
         << ")";
-     *ErrMsg = new string(ss.str());
-     return GDSIIRecord();
+     return new string(ss.str());
    }
 
   /*--------------------------------------------------------------*/
-  /*- attempt to read payload ------------------------------------*/
-  /*--------------------------------------------------------------*/
-  size_t PayloadSize = RecordSize - 4;
-  BYTE *Payload=0;
-  if (PayloadSize>0)
-   { Payload = new BYTE[PayloadSize];
-     if (Payload==0)
-      { *ErrMsg = new string("out of memory");
-        return GDSIIRecord();
-      }
-     if ( PayloadSize != fread((void *)Payload, 1, PayloadSize, f) )
-      { delete[] Payload;
-        *ErrMsg = new string("unexpected end of file");
-        return GDSIIRecord();
-      }
-   }
- 
-  /*--------------------------------------------------------------*/
-  /* allocate space for the record and process payload data       */
+  /*- make sure the whole record is available --------------------*/
   /*--------------------------------------------------------------*/
-  GDSIIRecord Record;
-  Record.RType   = RType;
-  Record.NumVals = 0;
-  Record.sVal    = 0;
+  const BYTE *Bytes = Reader->Peek(RecordSize);
+  if (!Bytes)
+   return new string("unexpected end of file");
+  Reader->Skip(RecordSize);
+
+  Record->RType       = RType;
+  Record->DType       = DType;
+  Record->Payload     = Bytes + 4;
+  Record->PayloadSize = RecordSize - 4;
 
   switch(DType)
    { case NO_DATA:
+       Record->NumVals = 0;
        break;
 
      case BITARRAY:
-      { Record.NumVals=1;
-        WORD W = *(WORD *)Payload;
-        for(unsigned nf=0, Flag=1; nf<16; nf++, Flag*=2)
-         Record.Bits[nf] = (W & Flag);
-      };
-     break;
-
      case STRING:
-      Record.NumVals=1;
-      Record.sVal = MakeGDSIIString( (char *)Payload, PayloadSize );
-      break;
-
-     case INTEGER_2:
-     case INTEGER_4:
-      { size_t DataSize = (DType==INTEGER_2) ? 2 : 4;
-        Record.NumVals  = PayloadSize / DataSize;
-        BYTE *B=(BYTE *)Payload; 
-        for(size_t nv=0; nv<Record.NumVals; nv++, B+=DataSize)
-         Record.iVal.push_back( ConvertInt(B, RecordTypes[RType].DType) );
-      };
-     break;
+       Record->NumVals = 1;
+       break;
 
-     case REAL_4:
-     case REAL_8:
-      { size_t DataSize  = (DType==REAL_4) ? 4 : 8;
-        Record.NumVals   = PayloadSize / DataSize;
-        BYTE *B=(BYTE *)Payload; 
-        for(size_t nv=0; nv<Record.NumVals; nv++, B+=DataSize)
-         Record.dVal.push_back(ConvertReal(B, RecordTypes[RType].DType));
-      };
-     break;
+     case INTEGER_2: Record->NumVals = Record->PayloadSize / 2; break;
+     case INTEGER_4: Record->NumVals = Record->PayloadSize / 4; break;
+     case REAL_4:    Record->NumVals = Record->PayloadSize / 4; break;
+     case REAL_8:    Record->NumVals = Record->PayloadSize / 8; break;
 
      default:
-       *ErrMsg = new string("unknown data type " + DType);
-       return GDSIIRecord();
+      { ostringstream ss;
+        ss << "unknown data type " << (int)DType;
+        return new string(ss.str());
+      };
    };
 
+  if (DType==BITARRAY && Record->PayloadSize<2)
+   return new string("truncated BITARRAY record");
+
   // success 
-  *ErrMsg=0;
-  delete[] Payload;
-  return Record;
+  return 0;
+}
 
+/***************************************************************/
+/* examine the 4-byte header of the next record without        */
+/* touching its payload; returns false at end of input or if   */
+/* the header is invalid                                       */
+/***************************************************************/
+bool PeekGDSIIRecordHeader(GDSIIReader *Reader, size_t *RecordSize, int *RType)
+{
+  const BYTE *Header = Reader->Peek(4);
+  if (!Header)
+   return false;
+  *RecordSize = Header[0]*256 + Header[1];
+  *RType      = Header[2];
+  return (*RecordSize>=4 && *RType<=MAX_RTYPE);
 }
 
 /***************************************************************/
 /* get string description of GDSII record   ********************/
 /***************************************************************/
-string *GetRecordDescription(GDSIIRecord Record, bool Verbose=true)
+string *GetRecordDescription(GDSIIRecord *Record, bool Verbose=true)
 {
   char Name[15];
-  sprintf(Name,"%12s",RecordTypes[Record.RType].Name);
+  sprintf(Name,"%12s",RecordTypes[Record->RType].Name);
   ostringstream ss;
   ss << Name;
 
-  if (Record.NumVals>0)
-   ss << " ( " << Record.NumVals << ") ";
+  if (Record->NumVals>0)
+   ss << " ( " << Record->NumVals << ") ";
   
   if (!Verbose)
    return new string(ss.str());
 
   ss << " = ";
-  switch(RecordTypes[Record.RType].DType)
+  switch(RecordTypes[Record->RType].DType)
    { 
      case INTEGER_2:    
      case INTEGER_4:    
-      for(size_t nv=0; nv<Record.NumVals; nv++)
-       ss << Record.iVal[nv] << " ";
+      for(size_t nv=0; nv<Record->NumVals; nv++)
+       ss << GetRecordInt(Record, nv) << " ";
       break;
 
      case REAL_4:
      case REAL_8:
-      for(size_t nv=0; nv<Record.NumVals; nv++)
-       ss << Record.dVal[nv] << " ";
+      for(size_t nv=0; nv<Record->NumVals; nv++)
+       ss << GetRecordReal(Record, nv) << " ";
       break;
 
      case BITARRAY:
-      for(size_t n=0; n<16; n++)
-       ss << (Record.Bits[n] ? '1' : '0');
+      for(int n=0; n<16; n++)
+       ss << (GetRecordBit(Record, n) ? '1' : '0');
       break;
 
      case STRING:
-      if (Record.sVal)
-       ss << *(Record.sVal);
-      else
-       ss << "(null)";
+      { char Buffer[33];
+        ss << GetRecordString(Record, Buffer);
+      };
       break; 
 
      case NO_DATA:
@@ -717,13 +787,508 @@ string *GetRecordDescription(GDSIIRecord Record, bool Verbose=true)
 /*--------------------------------------------------------------*/
 /*--------------------------------------------------------------*/
 /*--------------------------------------------------------------*/
-void InitializeParseState(ParseState *PState, GDSIIData *Data)
+void InitializeParseState(ParseState *PState, GDSIIData *Data,
+                          GDSIIVisitor *Visitor=0)
 {
   PState->Data           = Data;
+  PState->Visitor        = Visitor;
   PState->NumRecords     = 0;
+  PState->Structs        = Data ? &(Data->Structs)  : 0;
+  PState->LayerSet       = Data ? &(Data->LayerSet) : 0;
+  PState->Arena          = 0;
+  PState->Options        = Data ? &(Data->ReadOptions) : 0;
+  PState->SkipElement    = false;
+  bool Hashed            = Data && Data->ReadOptions.Reloadable;
+  PState->StructHashes   = Hashed ? &(Data->StructHashes) : 0;
+  PState->HeaderHash     = Hashed ? &(Data->HeaderHash) : 0;
+  PState->Hash           = GDSII_HASH_SEED;
+  PState->InHeader       = true;
   PState->CurrentStruct  = 0;
   PState->CurrentElement = 0;
   PState->Status         = ParseState::INITIAL;
+  PState->PropAttr       = -1;
+}
+
+/*--------------------------------------------------------------*/
+/*- add a new storage arena to Data, for use by a single thread */
+/*--------------------------------------------------------------*/
+GDSIIArena *AddArena(GDSIIData *Data)
+{ 
+  GDSIIArena *Arena = new GDSIIArena;
+  Data->Arenas.push_back(Arena);
+  return Arena;
+}
+
+/*--------------------------------------------------------------*/
+/*- add a record to the hash of the library header or of the    */
+/*- structure to which it belongs (see ParseState)              */
+/*--------------------------------------------------------------*/
+static void HashRecord(ParseState *PState, const GDSIIRecord *Record)
+{
+  size_t RecordSize = Record->PayloadSize + 4;
+  BYTE Header[4] = { (BYTE)(RecordSize>>8), (BYTE)(RecordSize&0xFF), Record->RType, Record->DType };
+  if (Record->RType==RTYPE_ENDLIB)
+   { PState->InHeader=false;
+     return;
+   }
+  if (Record->RType==RTYPE_BGNSTR)
+   { PState->InHeader=false;
+     PState->Hash=GDSII_HASH_SEED;
+   }
+  PState->Hash = HashGDSIIRecord(PState->Hash, Header, Record->Payload, Record->PayloadSize);
+  if (PState->InHeader)
+   *(PState->HeaderHash) = PState->Hash;
+  else if (Record->RType==RTYPE_ENDSTR)
+   PState->StructHashes->push_back(PState->Hash);
+}
+
+/*--------------------------------------------------------------*/
+/*- read records one at a time until we hit ENDLIB (or reach    */
+/*- file offset EndOffset), dispatching each to its handler.    */
+/*- Returns 0 on success or an error message on failure.        */
+/*--------------------------------------------------------------*/
+string *ProcessGDSIIRecords(GDSIIReader *Reader, ParseState *PState,
+                            size_t EndOffset=((size_t)-1))
+{
+  string *ErrMsg=0;
+  while( PState->Status != ParseState::DONE && !ErrMsg && Reader->Tell()<EndOffset )
+   { 
+     // try to read the record
+     GDSIIRecord Record;
+     ErrMsg=ReadGDSIIRecord(Reader, &Record);
+     if (ErrMsg)
+      return ErrMsg;
+
+     if (PState->StructHashes)
+      HashRecord(PState, &Record);
+
+     // try to process the record if a handler is present
+     PState->NumRecords++;
+     RecordHandler Handler = RecordTypes[Record.RType].Handler;
+     if ( Handler )
+      ErrMsg = Handler(&Record, PState);
+     else 
+      GDSIIData::Warn("ignoring unsupported record %s",RecordTypes[Record.RType].Name);
+   }
+  return ErrMsg;
+}
+
+/*--------------------------------------------------------------*/
+/*- Pre-scan used for parallel parsing: hop from record header  */
+/*- to record header, without looking at payloads, to find the  */
+/*- byte range of each structure (BGNSTR through ENDSTR).       */
+/*- Returns false if the file does not have the expected layout,*/
+/*- in which case the caller should read it sequentially.       */
+/*--------------------------------------------------------------*/
+typedef struct StructRange
+ { size_t Offset, Length;
+ } StructRange;
+
+bool ScanStructRanges(GDSIIReader *Reader, vector<StructRange> *Ranges)
+{
+  size_t RecordSize, Begin=0;
+  int RType;
+  bool InStruct=false;
+  while( PeekGDSIIRecordHeader(Reader, &RecordSize, &RType) )
+   { 
+     size_t Offset = Reader->Tell();
+     Reader->Skip(RecordSize);
+     if (RType==RTYPE_BGNSTR)
+      { if (InStruct) return false;
+        InStruct = true;
+        Begin    = Offset;
+      }
+     else if (RType==RTYPE_ENDSTR)
+      { if (!InStruct) return false;
+        StructRange Range;
+        Range.Offset = Begin;
+        Range.Length = Reader->Tell() - Begin;
+        Ranges->push_back(Range);
+        InStruct = false;
+      }
+     else if (RType==RTYPE_ENDLIB)
+      return !InStruct;
+     else if (!InStruct && Ranges->size()>0)
+      return false; // stray record between structures
+   }
+  return false;
+}
+
+/*--------------------------------------------------------------*/
+/*- Parse the structures occupying the given byte ranges of the  */
+/*- file, appending them to Data->Structs in the order of the    */
+/*- ranges. If NumThreads>1 and the whole file is in memory, the */
+/*- structures are parsed concurrently, each by its own          */
+/*- ParseState into private storage, and the results are merged */
+/*- afterwards, so the outcome is identical to a serial read.    */
+/*- The library header must already have been read.             */
+/*--------------------------------------------------------------*/
+string *ParseStructRanges(GDSIIData *Data, GDSIIReader *Reader,
+                          vector<StructRange> &Ranges, int NumThreads)
+{
+  int NumStructs = Ranges.size();
+  size_t NumBytes;
+  const BYTE *Bytes = Reader->GetBytes(&NumBytes);
+  if (NumThreads<=1 || Bytes==0 || NumStructs<=1)
+   { ParseState PState;
+     InitializeParseState(&PState, Data);
+     PState.Status = ParseState::INLIB;
+     PState.Arena  = AddArena(Data);
+     for(int ns=0; ns<NumStructs; ns++)
+      { size_t Offset = Ranges[ns].Offset, Length = Ranges[ns].Length;
+        if ( !Reader->Seek(Offset) )
+         return new string("could not seek to structure");
+        string *ErrMsg = ProcessGDSIIRecords(Reader, &PState, Offset + Length);
+        if (ErrMsg)
+         return ErrMsg;
+      }
+     return 0;
+   }
+
+  GDSIIData::Log("Parsing %i structures on %i threads.",NumStructs,NumThreads);
+  vector<GDSIIStruct *> NewStructs(NumStructs, (GDSIIStruct *)0);
+  vector<unsigned long long> NewHashes(NumStructs, 0);
+  vector<string *> ErrMsgs(NumStructs, (string *)0);
+  vector< set<int> > LayerSets(NumThreads);
+  vector<GDSIIArena *> Arenas(NumThreads);
+  for(int nt=0; nt<NumThreads; nt++)
+   Arenas[nt] = AddArena(Data);
+#pragma omp parallel for schedule(dynamic,1) num_threads(NumThreads)
+  for(int ns=0; ns<NumStructs; ns++)
+   { 
+     int nt=0;
+#ifdef _OPENMP
+     nt=omp_get_thread_num();
+#endif
+     vector<GDSIIStruct *> ThisStruct;
+     vector<unsigned long long> ThisHash;
+     ParseState SPState;
+     InitializeParseState(&SPState, Data);
+     SPState.Status   = ParseState::INLIB;
+     SPState.Structs  = &ThisStruct;
+     if (SPState.StructHashes)
+      SPState.StructHashes = &ThisHash;
+     SPState.LayerSet = &(LayerSets[nt]);
+     SPState.Arena    = Arenas[nt];
+
+     GDSIIReader SReader;
+     size_t Offset = Ranges[ns].Offset, Length = Ranges[ns].Length;
+     SReader.Open(Bytes + Offset, Length, Offset);
+     ErrMsgs[ns] = ProcessGDSIIRecords(&SReader, &SPState, Offset + Length);
+     if (ThisStruct.size()>0)
+      NewStructs[ns] = ThisStruct[0];
+     if (ThisHash.size()>0)
+      NewHashes[ns] = ThisHash[0];
+   }
+
+  string *ErrMsg=0;
+  for(int ns=0; ns<NumStructs; ns++)
+   { if (NewStructs[ns])
+      Data->Structs.push_back(NewStructs[ns]);
+     if (NewStructs[ns] && Data->ReadOptions.Reloadable)
+      Data->StructHashes.push_back(NewHashes[ns]);
+     if (ErrMsgs[ns] && ErrMsg)
+      delete ErrMsgs[ns];
+     else if (ErrMsgs[ns])
+      ErrMsg = ErrMsgs[ns];
+   }
+  for(int nt=0; nt<NumThreads; nt++)
+   Data->LayerSet.insert(LayerSets[nt].begin(), LayerSets[nt].end());
+  Reader->Seek(Ranges[NumStructs-1].Offset + Ranges[NumStructs-1].Length);
+  return ErrMsg;
+}
+
+/*--------------------------------------------------------------*/
+/*- Parse the library header, i.e. everything before the first  */
+/*- structure, which begins at file offset HeaderLength.        */
+/*--------------------------------------------------------------*/
+string *ParseLibraryHeader(GDSIIReader *Reader, ParseState *PState, size_t HeaderLength)
+{
+  string *ErrMsg = ProcessGDSIIRecords(Reader, PState, HeaderLength);
+  if (ErrMsg)
+   return ErrMsg;
+  if (PState->Status!=ParseState::INLIB)
+   return new string("unexpected end of library header");
+  return 0;
+}
+
+/*--------------------------------------------------------------*/
+/*- Parse the library header and the single structure named     */
+/*- StructName, which is located via the file's sidecar index   */
+/*- so that everything in between is skipped unread.            */
+/*--------------------------------------------------------------*/
+string *ParseIndexedStruct(const char *FileName, const char *StructName,
+                           const char *IndexFileName, ParseState *PState)
+{
+  string *ErrMsg=0;
+  GDSIIIndex *Index = GetGDSIIIndex(FileName, IndexFileName, &ErrMsg);
+  if (!Index)
+   return ErrMsg;
+  GDSIIIndexEntry *Entry = FindGDSIIIndexEntry(Index, StructName);
+  if (!Entry)
+   { delete Index;
+     return new string(string("structure ") + StructName + " not found");
+   }
+  size_t HeaderLength = Index->HeaderLength;
+  size_t Offset = Entry->Offset, Length = Entry->Length;
+  delete Index;
+
+  GDSIIReader Reader;
+  if ( (ErrMsg=Reader.Open(FileName)) )
+   return ErrMsg;
+  if ( (ErrMsg=ParseLibraryHeader(&Reader, PState, HeaderLength)) )
+   return ErrMsg;
+  if ( !Reader.Seek(Offset) )
+   return new string(string("could not seek to structure ") + StructName);
+  return ProcessGDSIIRecords(&Reader, PState, Offset + Length);
+}
+
+/***************************************************************/
+/* Read a single structure from a GDSII file without reading   */
+/* the rest of the file. Returns 0 on failure, in which case   */
+/* *ErrMsg (if ErrMsg is non-null) is set to an error message. */
+/***************************************************************/
+GDSIIStruct *ReadGDSIIStruct(const char *GDSIIFileName, const char *StructName,
+                             string **ErrMsg, const char *IndexFileName)
+{
+  vector<GDSIIStruct *> Structs;
+  set<int> LayerSet;
+  ParseState PState;
+  InitializeParseState(&PState, 0);
+  PState.Structs  = &Structs;
+  PState.LayerSet = &LayerSet;
+  PState.Arena    = new GDSIIArena;
+  string *Err = ParseIndexedStruct(GDSIIFileName, StructName, IndexFileName, &PState);
+  if (Err==0 && Structs.size()==1)
+   { Structs[0]->Arena = PState.Arena;
+     return Structs[0];
+   }
+
+  for(size_t ns=0; ns<Structs.size(); ns++)
+   DeleteGDSIIStruct(Structs[ns]);
+  delete PState.Arena;
+  if (Err==0)
+   Err = new string(string("structure ") + StructName + " not found");
+  if (ErrMsg)
+   *ErrMsg = Err;
+  else
+   delete Err;
+  return 0;
+}
+
+/*--------------------------------------------------------------*/
+/*- Parse an entire GDSII file into Data. If multithreaded       */
+/*- parsing was requested and the whole file is in memory,      */
+/*- pre-scan the record headers to locate the structures and    */
+/*- parse them in parallel; otherwise read records one at a     */
+/*- time until we hit ENDLIB.                                   */
+/*--------------------------------------------------------------*/
+string *ParseGDSIIData(GDSIIData *Data, GDSIIReader *Reader, int NumThreads)
+{
+  string *ErrMsg;
+  size_t NumBytes;
+  vector<StructRange> Ranges;
+  ParseState PState;
+  InitializeParseState(&PState, Data);
+  if (    NumThreads>1 && Reader->GetBytes(&NumBytes)
+       && ScanStructRanges(Reader, &Ranges) && Ranges.size()>0
+     )
+   { Reader->Seek(0);
+     if (    (ErrMsg=ParseLibraryHeader(Reader, &PState, Ranges[0].Offset))
+          || (ErrMsg=ParseStructRanges(Data, Reader, Ranges, NumThreads))
+        )
+      return ErrMsg;
+     return ProcessGDSIIRecords(Reader, &PState); // library trailer
+   }
+
+  Reader->Seek(0); // rewind after any pre-scan
+  PState.Arena = AddArena(Data);
+  return ProcessGDSIIRecords(Reader, &PState);
+}
+
+/*--------------------------------------------------------------*/
+/*- Use the index to find the structures reachable from TopCell  */
+/*- via SREFs and AREFs: InClosure[n] is set to true if the     */
+/*- structure of index entry #n is reachable.                   */
+/*--------------------------------------------------------------*/
+string *GetStructClosure(GDSIIIndex *Index, const char *TopCell, bVec *pInClosure)
+{
+  map<string,int> EntryByName;
+  for(size_t n=0; n<Index->Entries.size(); n++)
+   EntryByName.insert( pair<string,int>(Index->Entries[n].Name, n) );
+
+  bVec &InClosure = *pInClosure;
+  InClosure.assign(Index->Entries.size(), false);
+  iVec ToVisit;
+  map<string,int>::iterator it=EntryByName.find(TopCell);
+  if (it==EntryByName.end())
+   return new string(string("structure ") + TopCell + " not found");
+  InClosure[it->second]=true;
+  ToVisit.push_back(it->second);
+  while(ToVisit.size()>0)
+   { GDSIIIndexEntry *Entry = &(Index->Entries[ToVisit.back()]);
+     ToVisit.pop_back();
+     for(size_t nc=0; nc<Entry->Children.size(); nc++)
+      { it=EntryByName.find(Entry->Children[nc]);
+        if (it!=EntryByName.end() && !InClosure[it->second])
+         { InClosure[it->second]=true;
+           ToVisit.push_back(it->second);
+         }
+      }
+   }
+  return 0;
+}
+
+/*--------------------------------------------------------------*/
+/*- Parse the library header and those structures reachable     */
+/*- from TopCell via SREFs and AREFs. The reachable set is      */
+/*- computed from the index, and all other structures are       */
+/*- skipped without being read.                                 */
+/*--------------------------------------------------------------*/
+string *ParseStructClosure(GDSIIData *Data, const char *FileName, const char *TopCell,
+                           const char *IndexFileName, int NumThreads)
+{
+  string *ErrMsg=0;
+  GDSIIIndex *Index = GetGDSIIIndex(FileName, IndexFileName, &ErrMsg);
+  if (!Index)
+   return ErrMsg;
+
+  bVec InClosure;
+  if ( (ErrMsg=GetStructClosure(Index, TopCell, &InClosure)) )
+   { delete Index;
+     return ErrMsg;
+   }
+
+  // structures are read in file order
+  vector<StructRange> Ranges;
+  for(size_t n=0; n<Index->Entries.size(); n++)
+   if (InClosure[n])
+    { StructRange Range;
+      Range.Offset = Index->Entries[n].Offset;
+      Range.Length = Index->Entries[n].Length;
+      Ranges.push_back(Range);
+    }
+  size_t HeaderLength = Index->HeaderLength;
+  GDSIIData::Log("Reading %lu of %lu structures reachable from %s.",
+                  Ranges.size(),Index->Entries.size(),TopCell);
+  delete Index;
+
+  GDSIIReader Reader;
+  if ( (ErrMsg=Reader.Open(FileName)) )
+   return ErrMsg;
+  ParseState PState;
+  InitializeParseState(&PState, Data);
+  if ( (ErrMsg=ParseLibraryHeader(&Reader, &PState, HeaderLength)) )
+   return ErrMsg;
+  return ParseStructRanges(Data, &Reader, Ranges, NumThreads);
+}
+
+/*--------------------------------------------------------------*/
+/*- Content hash of a block of bytes, mixed in 8 bytes at a time */
+/*--------------------------------------------------------------*/
+unsigned long long HashGDSIIBytes(unsigned long long Hash, const BYTE *Bytes, size_t NumBytes)
+{
+  const unsigned long long Multiplier=0x9E3779B97F4A7C15ULL;
+  size_t n=0;
+  for(; n+8<=NumBytes; n+=8)
+   { unsigned long long Word;
+     memcpy(&Word, Bytes+n, 8);
+     Hash  = (Hash ^ Word) * Multiplier;
+     Hash ^= Hash>>32;
+   }
+  for(; n<NumBytes; n++)
+   { Hash  = (Hash ^ Bytes[n]) * Multiplier;
+     Hash ^= Hash>>32;
+   }
+  return Hash;
+}
+
+/*--------------------------------------------------------------*/
+/*- Content hash of a record (given its 4-byte header and its    */
+/*- payload), continuing from Hash. The timestamps in BGNLIB and */
+/*- BGNSTR records are left out, as they change whenever the     */
+/*- file is saved.                                               */
+/*--------------------------------------------------------------*/
+unsigned long long HashGDSIIRecord(unsigned long long Hash, const BYTE *Header,
+                                   const BYTE *Payload, size_t PayloadSize)
+{
+  Hash = HashGDSIIBytes(Hash, Header, 4);
+  if (Header[2]==RTYPE_BGNLIB || Header[2]==RTYPE_BGNSTR)
+   return Hash;
+  return HashGDSIIBytes(Hash, Payload, PayloadSize);
+}
+
+/*--------------------------------------------------------------*/
+/*- Index the file and hash its library header and each of the  */
+/*- structures that are read into Data under its read options,  */
+/*- in a single pass over the file (the hashes are those that   */
+/*- parsing with ReadOptions.Reloadable computes, and are       */
+/*- stored in file order, i.e. in the order of Data->Structs).  */
+/*- Index is set to the index of the file, and Selection to the */
+/*- index entries of the hashed structures.                     */
+/*--------------------------------------------------------------*/
+string *HashGDSIIFile(GDSIIData *Data, const char *FileName,
+                      GDSIIIndex *Index, unsigned long long *HeaderHash,
+                      vector<unsigned long long> *StructHashes, iVec *Selection)
+{
+  vector<unsigned long long> AllHashes;
+  string *ErrMsg = IndexGDSIIFile(FileName, Index, HeaderHash, &AllHashes);
+  if (ErrMsg)
+   return ErrMsg;
+
+  Selection->clear();
+  GDSIIReadOptions *Options = &(Data->ReadOptions);
+  if ( !Options->StructName.empty() )
+   { GDSIIIndexEntry *Entry = FindGDSIIIndexEntry(Index, Options->StructName.c_str());
+     if (!Entry)
+      return new string(string("structure ") + Options->StructName + " not found");
+     Selection->push_back(Entry - &(Index->Entries[0]));
+   }
+  else if ( !Options->TopCell.empty() )
+   { bVec InClosure;
+     if ( (ErrMsg=GetStructClosure(Index, Options->TopCell.c_str(), &InClosure)) )
+      return ErrMsg;
+     for(size_t n=0; n<InClosure.size(); n++)
+      if (InClosure[n])
+       Selection->push_back(n);
+   }
+  else
+   for(size_t n=0; n<Index->Entries.size(); n++)
+    Selection->push_back(n);
+
+  StructHashes->resize(Selection->size());
+  for(size_t n=0; n<Selection->size(); n++)
+   (*StructHashes)[n] = AllHashes[(*Selection)[n]];
+  return 0;
+}
+
+/*--------------------------------------------------------------*/
+/*- Build the hash table of structure names, resolve the        */
+/*- structure references of SREF and AREF elements, and note    */
+/*- which structures are referenced by others.                  */
+/*--------------------------------------------------------------*/
+void GDSIIData::ResolveReferences()
+{
+  // if a name occurs more than once, references go to
+  // the first structure of that name
+  StructIDs.clear();
+  for(size_t ns=0; ns<Structs.size(); ns++)
+   { Structs[ns]->IsReferenced=false;
+     if (Structs[ns]->Name)
+      StructIDs.insert( pair<string,int>(*(Structs[ns]->Name), ns) );
+   }
+
+  for(size_t ns=0; ns<Structs.size(); ns++)
+   for(size_t ne=0; ne<Structs[ns]->Elements.size(); ne++)
+    { GDSIIElement *e=Structs[ns]->Elements[ne];
+      if(e->Type==SREF || e->Type==AREF)
+       { e->nsRef = GetStructByName( *(e->SName) );
+         if (e->nsRef!=-1)
+          Structs[e->nsRef]->IsReferenced=true;
+         else if (ReadOptions.StructName.empty())
+          Warn("reference to unknown struct %s ",e->SName->c_str());
+       }
+    }
 }
 
 /*--------------------------------------------------------------*/
@@ -732,65 +1297,518 @@ void InitializeParseState(ParseState *PState, GDSIIData *Data)
 /*--------------------------------------------------------------*/
 void GDSIIData::ReadGDSIIFile(const string FileName, double CoordinateLengthUnit)
  {
-   ErrMsg=0;
-
    /*--------------------------------------------------------------*/
-   /*- try to open the file ---------------------------------------*/
-   /*--------------------------------------------------------------*/
-   FILE *f=fopen(FileName.c_str(),"r");
-   if (!f)
-    { ErrMsg = new string("could not open " + FileName);
-      return;
-    }
-
+   /*- if only a single structure, or the hierarchy below a given  */
+   /*- top cell, was requested, read just those structures,        */
+   /*- located via the index; otherwise read everything            */
    /*--------------------------------------------------------------*/
-   /*- read records one at a time until we hit ENDLIB              */
+   /*- with ReadOptions.Reloadable, the library header and each    */
+   /*- structure are hashed as they are parsed (see ParseState)     */
    /*--------------------------------------------------------------*/
-   ParseState PState;
-   InitializeParseState(&PState, this);
-   while( PState.Status != ParseState::DONE && !ErrMsg )
-    { 
-      // try to read the record
-      GDSIIRecord Record=ReadGDSIIRecord(f, &ErrMsg);
-      if (ErrMsg)
-       return;
-
-      // try to process the record if a handler is present
-      PState.NumRecords++;
-      RecordHandler Handler = RecordTypes[Record.RType].Handler;
-      if ( Handler )
-       ErrMsg = Handler(Record, &PState);
-      else 
-       Warn("ignoring unsupported record %s",RecordTypes[Record.RType].Name);
+   int NumThreads = GetNumThreads(ReadOptions.NumThreads);
+   HeaderHash = GDSII_HASH_SEED;
+   StructHashes.clear();
+   if ( !ReadOptions.StructName.empty() )
+    { ParseState PState;
+      InitializeParseState(&PState, this);
+      PState.Arena = AddArena(this);
+      ErrMsg = ParseIndexedStruct(FileName.c_str(), ReadOptions.StructName.c_str(),
+                                  ReadOptions.IndexFileName.c_str(), &PState);
+    }
+   else if ( !ReadOptions.TopCell.empty() )
+    ErrMsg = ParseStructClosure(this, FileName.c_str(), ReadOptions.TopCell.c_str(),
+                                ReadOptions.IndexFileName.c_str(), NumThreads);
+   else
+    { GDSIIReader Reader;
+      ErrMsg = Reader.Open(FileName.c_str());
+      if (!ErrMsg)
+       ErrMsg = ParseGDSIIData(this, &Reader, NumThreads);
     }
-   fclose(f);
    if (ErrMsg) return;
  
-   // convert layer set to vector
-   for(set<int>::iterator it=LayerSet.begin(); it!=LayerSet.end(); it++)
-    Layers.push_back(*it);
+   ProcessStructs(CoordinateLengthUnit);
+}
 
-   /*--------------------------------------------------------------*/
-   /*- Go back through the hierarchy to note which structures are  */
-   /*- referenced by others.                                       */
-   /*--------------------------------------------------------------*/
-   for(size_t ns=0; ns<Structs.size(); ns++)
-    for(size_t ne=0; ne<Structs[ns]->Elements.size(); ne++)
-     { GDSIIElement *e=Structs[ns]->Elements[ne];
-       if(e->Type==SREF || e->Type==AREF)
-        { e->nsRef = GetStructByName( *(e->SName) );
-          if (e->nsRef==-1)
-           Warn("reference to unknown struct %s ",e->SName->c_str());
-          else 
-           Structs[e->nsRef]->IsReferenced=true;
+/*--------------------------------------------------------------*/
+/*- Read GDSII data from a memory block or a stream, which is   */
+/*- parsed in its entirety; reading individual structures or    */
+/*- hierarchies requires an index, and thus a file.             */
+/*--------------------------------------------------------------*/
+void GDSIIData::ReadGDSIIData(GDSIIReader *Reader, double CoordinateLengthUnit)
+{
+  if ( !ReadOptions.StructName.empty() || !ReadOptions.TopCell.empty() )
+   { ErrMsg = new string("reading individual structures requires a GDSII file");
+     return;
+   }
+  ErrMsg = ParseGDSIIData(this, Reader, GetNumThreads(ReadOptions.NumThreads));
+  if (ErrMsg) return;
+
+  ProcessStructs(CoordinateLengthUnit);
+}
+
+/*--------------------------------------------------------------*/
+/*- Recompute the layer set from the elements of all structures */
+/*- (after structures have been added or removed).              */
+/*--------------------------------------------------------------*/
+static void CollectLayers(GDSIIData *Data)
+{
+  Data->LayerSet.clear();
+  for(size_t ns=0; ns<Data->Structs.size(); ns++)
+   for(size_t ne=0; ne<Data->Structs[ns]->Elements.size(); ne++)
+    { GDSIIElement *e = Data->Structs[ns]->Elements[ne];
+      if (e->Type!=SREF && e->Type!=AREF)
+       Data->LayerSet.insert(e->Layer);
+    }
+}
+
+/*--------------------------------------------------------------*/
+/*- Convert the coordinates of all elements of s from database  */
+/*- units of one size to those of another, Scale times smaller. */
+/*- Returns false if a coordinate does not fit in the integers  */
+/*- of the new unit; *NumRounded is incremented by the number   */
+/*- of coordinates that do not land exactly on the new grid.    */
+/*--------------------------------------------------------------*/
+static bool RescaleValue(int *Value, double Scale, size_t *NumRounded)
+{
+  double x = Scale * (*Value);
+  if ( fabs(x) > (double)INT_MAX )
+   return false;
+  long r = lround(x);
+  if ( fabs(x - r) > 1.0e-6 )
+   (*NumRounded)++;
+  *Value = (int)r;
+  return true;
+}
+
+static bool RescaleStruct(GDSIIStruct *s, double Scale, size_t *NumRounded)
+{
+  for(size_t ne=0; ne<s->Elements.size(); ne++)
+   { GDSIIElement *e = s->Elements[ne];
+     for(size_t n=0; n<e->XY.size(); n++)
+      if ( !RescaleValue(e->XY.Values + n, Scale, NumRounded) )
+       return false;
+     if ( !RescaleValue(&(e->Width), Scale, NumRounded) )
+      return false;
+   }
+  return true;
+}
+
+/*--------------------------------------------------------------*/
+/*- Read several GDSII files concurrently, one per thread, and   */
+/*- merge their structures into a single hierarchy, so that     */
+/*- references may be resolved across files. If a structure     */
+/*- name occurs in more than one file, only the first structure */
+/*- of that name (in the order of FileNames) is kept. The       */
+/*- database unit is the finest among the files, so that        */
+/*- coordinates in files using coarser units are converted by   */
+/*- (usually integer) magnification; user units are those of    */
+/*- the first file.                                             */
+/*--------------------------------------------------------------*/
+void GDSIIData::ReadGDSIIFiles(const strVec &FileNames, double CoordinateLengthUnit)
+{
+  if ( !ReadOptions.StructName.empty() )
+   { ErrMsg = new string("reading individual structures requires a single GDSII file");
+     return;
+   }
+
+  /*--------------------------------------------------------------*/
+  /*- parse each file into a GDSIIData of its own                 */
+  /*--------------------------------------------------------------*/
+  int NumFiles = FileNames.size();
+  int NumThreads = ReadOptions.NumThreads>0 ? ReadOptions.NumThreads : NumFiles;
+  vector<GDSIIData *> Parts(NumFiles);
+  Log("Reading %i GDSII files on %i threads.",NumFiles,NumThreads);
+#pragma omp parallel for schedule(dynamic,1) num_threads(NumThreads)
+  for(int nf=0; nf<NumFiles; nf++)
+   { GDSIIData *Part = Parts[nf] = new GDSIIData();
+     Part->ReadOptions = ReadOptions;
+     Part->ReadOptions.Reloadable = false; // merged data can not be reloaded
+     GDSIIReader Reader;
+     Part->ErrMsg = Reader.Open(FileNames[nf].c_str());
+     if (!Part->ErrMsg)
+      Part->ErrMsg = ParseGDSIIData(Part, &Reader, 1);
+   }
+
+  /*--------------------------------------------------------------*/
+  /*- merge them                                                  */
+  /*--------------------------------------------------------------*/
+  bool First=true;
+  for(int nf=0; nf<NumFiles; nf++)
+   if (!Parts[nf]->ErrMsg)
+    { if (First || Parts[nf]->FileUnits[1] < FileUnits[1])
+       FileUnits[1] = Parts[nf]->FileUnits[1];
+      if (First)
+       UnitInMeters = Parts[nf]->UnitInMeters;
+      First=false;
+    }
+  FileUnits[0] = FileUnits[1] / UnitInMeters;
+
+  unordered_map<string,int> Origin; // Origin[Name] = file in which a structure was first seen
+  for(int nf=0; nf<NumFiles; nf++)
+   { 
+     GDSIIData *Part = Parts[nf];
+     if (Part->ErrMsg)
+      { if (!ErrMsg)
+         ErrMsg = new string(FileNames[nf] + ": " + *(Part->ErrMsg));
+        delete Part;
+        continue;
+      }
+
+     if (nf==0)
+      { LibName        = Part->LibName;
+        Part->LibName  = 0;
+      }
+
+     // the ratio of database units is usually an integer, which
+     // is made exact
+     double Scale = Part->FileUnits[1] / FileUnits[1];
+     if ( fabs(Scale - lround(Scale)) < 1.0e-9*Scale )
+      Scale = lround(Scale);
+     if (Scale!=1.0)
+      Log("Converting coordinates in %s to database unit %e m.",FileNames[nf].c_str(),FileUnits[1]);
+     size_t NumRounded=0;
+
+     for(size_t ns=0; ns<Part->Structs.size(); ns++)
+      { GDSIIStruct *s = Part->Structs[ns];
+        string Name = s->Name ? *(s->Name) : string();
+        unordered_map<string,int>::iterator it = Origin.find(Name);
+        if (it!=Origin.end() && it->second!=nf)
+         { Log("Structure %s in %s was already read from %s (skipping).",
+                Name.c_str(),FileNames[nf].c_str(),FileNames[it->second].c_str());
+           DeleteGDSIIStruct(s);
+           continue;
+         }
+        Origin.insert( pair<string,int>(Name, nf) );
+        if ( Scale!=1.0 && !RescaleStruct(s, Scale, &NumRounded) && !ErrMsg )
+         ErrMsg = new string(FileNames[nf] + ": coordinates in structure " + Name
+                             + " are out of range in the common database unit");
+        Structs.push_back(s);
+      }
+     if (NumRounded>0)
+      Warn("%s: %lu coordinates rounded to the common database unit %e m",
+            FileNames[nf].c_str(),(unsigned long)NumRounded,FileUnits[1]);
+     Arenas.insert(Arenas.end(), Part->Arenas.begin(), Part->Arenas.end());
+     Part->Structs.clear();
+     Part->Arenas.clear();
+     delete Part;
+   }
+  if (ErrMsg) return;
+
+  /*--------------------------------------------------------------*/
+  /*- if a top cell was specified, discard all structures not    */
+  /*- reachable from it                                          */
+  /*--------------------------------------------------------------*/
+  if ( !ReadOptions.TopCell.empty() )
+   { ResolveReferences();
+     int nsTop = GetStructByName(ReadOptions.TopCell);
+     if (nsTop==-1)
+      { ErrMsg = new string(string("structure ") + ReadOptions.TopCell + " not found");
+        return;
+      }
+     bVec Reachable(Structs.size(), false);
+     iVec ToVisit(1, nsTop);
+     Reachable[nsTop]=true;
+     while(ToVisit.size()>0)
+      { GDSIIStruct *s = Structs[ToVisit.back()];
+        ToVisit.pop_back();
+        for(size_t ne=0; ne<s->Elements.size(); ne++)
+         { int nsRef = s->Elements[ne]->nsRef;
+           if ( (s->Elements[ne]->Type==SREF || s->Elements[ne]->Type==AREF)
+                && nsRef!=-1 && !Reachable[nsRef] )
+            { Reachable[nsRef]=true;
+              ToVisit.push_back(nsRef);
+            }
+         }
+      }
+     vector<GDSIIStruct *> AllStructs;
+     AllStructs.swap(Structs);
+     for(size_t ns=0; ns<AllStructs.size(); ns++)
+      if (Reachable[ns])
+       Structs.push_back(AllStructs[ns]);
+      else
+       DeleteGDSIIStruct(AllStructs[ns]);
+   }
+
+  CollectLayers(this);
+  ProcessStructs(CoordinateLengthUnit);
+}
+
+/*--------------------------------------------------------------*/
+/*- Index and cross-reference the structures that have been     */
+/*- read, then flatten the hierarchy to obtain simple           */
+/*- unstructured lists of polygons and text labels on each      */
+/*- layer.                                                      */
+/*--------------------------------------------------------------*/
+void GDSIIData::ProcessStructs(double CoordinateLengthUnit)
+{
+  // convert layer set to vector
+  for(set<int>::iterator it=LayerSet.begin(); it!=LayerSet.end(); it++)
+   Layers.push_back(*it);
+
+  ResolveReferences();
+
+  Flatten(CoordinateLengthUnit);
+}
+
+/***************************************************************/
+/* Bring the data up to date with the current content of the   */
+/* GDSII file. Structures are matched by name to those read    */
+/* before; those whose content hash is unchanged are kept as   */
+/* they are, the others are re-read. The entities contributed  */
+/* to FlatTable by unchanged top-level structures that do not     */
+/* reference changed structures, directly or indirectly, are   */
+/* carried over; all others are re-flattened. Storage used by  */
+/* the elements of replaced structures is only released when   */
+/* the GDSIIData is deleted.                                   */
+/***************************************************************/
+bool GDSIIData::Reload()
+{
+  if (ErrMsg)
+   { delete ErrMsg;
+     ErrMsg=0;
+   }
+  if (!GDSIIFileName)
+   { ErrMsg = new string("data not read from a GDSII file can not be reloaded");
+     return false;
+   }
+  if (GDSIIFileNames.size()>1)
+   { ErrMsg = new string("data merged from several GDSII files can not be reloaded");
+     return false;
+   }
+  const char *FileName = GDSIIFileName->c_str();
+
+  /*--------------------------------------------------------------*/
+  /*- if we have no hashes to compare against, or the library    */
+  /*- header has changed, read the whole file again              */
+  /*--------------------------------------------------------------*/
+  GDSIIIndex Index;
+  iVec Selection;
+  unsigned long long NewHeaderHash=0;
+  vector<unsigned long long> NewHashes;
+  bool Incremental = (ReadOptions.Reloadable && StructHashes.size()==Structs.size());
+  if (Incremental)
+   { ErrMsg = HashGDSIIFile(this, FileName, &Index, &NewHeaderHash, &NewHashes, &Selection);
+     if (ErrMsg)
+      return false;
+     Incremental = (NewHeaderHash==HeaderHash);
+   }
+  if (!Incremental)
+   { Log("Re-reading GDSII file %s.",FileName);
+     double CoordinateLengthUnit = LengthUnit;
+     Clear();
+     ReadOptions.Reloadable=true;
+     ReadGDSIIFile(*GDSIIFileName, CoordinateLengthUnit);
+     return ErrMsg==0;
+   }
+
+  /*--------------------------------------------------------------*/
+  /*- match structures in the file to unchanged structures we     */
+  /*- already have, and note the byte ranges of all others        */
+  /*--------------------------------------------------------------*/
+  int NumStructs = Selection.size(), NumOldStructs = Structs.size();
+  iVec OldIndex(NumStructs, -1);
+  bVec Kept(NumOldStructs, false);
+  vector<StructRange> Ranges;
+  bool Unchanged = (NumStructs==NumOldStructs);
+  for(int ns=0; ns<NumStructs; ns++)
+   { GDSIIIndexEntry *Entry = &(Index.Entries[Selection[ns]]);
+     int nsOld = GetStructByName(Entry->Name);
+     if ( nsOld!=-1 && !Kept[nsOld] && StructHashes[nsOld]==NewHashes[ns] )
+      { OldIndex[ns] = nsOld;
+        Kept[nsOld]  = true;
+      }
+     else
+      { StructRange Range;
+        Range.Offset = Entry->Offset;
+        Range.Length = Entry->Length;
+        Ranges.push_back(Range);
+      }
+     Unchanged = Unchanged && (OldIndex[ns]==ns);
+   }
+  if (Unchanged)
+   return true;
+  Log("Re-reading %lu of %i structures in %s.",Ranges.size(),NumStructs,FileName);
+
+  /*--------------------------------------------------------------*/
+  /*- read the new and changed structures, leaving everything     */
+  /*- as it was if this fails                                     */
+  /*--------------------------------------------------------------*/
+  vector<GDSIIStruct *> OldStructs, NewStructs;
+  OldStructs.swap(Structs);
+  if (Ranges.size()>0)
+   { GDSIIReader Reader;
+     ErrMsg = Reader.Open(FileName);
+     if (!ErrMsg)
+      ErrMsg = ParseStructRanges(this, &Reader, Ranges, GetNumThreads(ReadOptions.NumThreads));
+     if (!ErrMsg && Structs.size()!=Ranges.size())
+      ErrMsg = new string("structure layout of file changed while reading");
+   }
+  NewStructs.swap(Structs);
+  if (ErrMsg)
+   { for(size_t ns=0; ns<NewStructs.size(); ns++)
+      DeleteGDSIIStruct(NewStructs[ns]);
+     Structs.swap(OldStructs);
+     return false;
+   }
+
+  // note which structures were flattened as top-level structures
+  bVec OldTopLevel(NumOldStructs);
+  for(int ns=0; ns<NumOldStructs; ns++)
+   OldTopLevel[ns] = !(OldStructs[ns]->IsPCell || OldStructs[ns]->IsReferenced);
+
+  // note the structures referenced by the kept structures, which
+  // may be resolved differently once the new ones are in place
+  vector<GDSIIStruct *> OldTargets;
+  for(int ns=0; ns<NumStructs; ns++)
+   if (OldIndex[ns]!=-1)
+    { GDSIIStruct *s = OldStructs[OldIndex[ns]];
+      for(size_t ne=0; ne<s->Elements.size(); ne++)
+       if (s->Elements[ne]->Type==SREF || s->Elements[ne]->Type==AREF)
+        { int nsRef = s->Elements[ne]->nsRef;
+          OldTargets.push_back( nsRef==-1 ? 0 : OldStructs[nsRef] );
         }
-     }
+    }
 
-   /*--------------------------------------------------------------*/
-   /*- Flatten hierarchy to obtain simple unstructured lists       */
-   /*- of polygons and text labels on each layer.                  */
-   /*--------------------------------------------------------------*/
-   Flatten(CoordinateLengthUnit);
+  for(int ns=0, nNew=0; ns<NumStructs; ns++)
+   Structs.push_back( OldIndex[ns]==-1 ? NewStructs[nNew++] : OldStructs[OldIndex[ns]] );
+  StructHashes = NewHashes;
+  ResolveReferences();
+
+  // the layer set may have grown or shrunk
+  CollectLayers(this);
+  iVec OldLayers = Layers;
+  Layers.assign(LayerSet.begin(), LayerSet.end());
+
+  /*--------------------------------------------------------------*/
+  /*- the new and changed structures, and all structures that     */
+  /*- reference them, must be re-flattened                        */
+  /*--------------------------------------------------------------*/
+  vector<iVec> Parents(NumStructs);
+  for(int ns=0; ns<NumStructs; ns++)
+   for(size_t ne=0; ne<Structs[ns]->Elements.size(); ne++)
+    { GDSIIElement *e = Structs[ns]->Elements[ne];
+      if ( (e->Type==SREF || e->Type==AREF) && e->nsRef!=-1 )
+       Parents[e->nsRef].push_back(ns);
+    }
+  bVec Dirty(NumStructs, false);
+  iVec ToVisit;
+  for(int ns=0, nt=0; ns<NumStructs; ns++)
+   { Dirty[ns] = (OldIndex[ns]==-1);
+     for(size_t ne=0; OldIndex[ns]!=-1 && ne<Structs[ns]->Elements.size(); ne++)
+      { GDSIIElement *e = Structs[ns]->Elements[ne];
+        if (e->Type==SREF || e->Type==AREF)
+         Dirty[ns] = Dirty[ns] || OldTargets[nt++]!=(e->nsRef==-1 ? 0 : Structs[e->nsRef]);
+      }
+     if (Dirty[ns])
+      ToVisit.push_back(ns);
+   }
+  while(ToVisit.size()>0)
+   { int ns=ToVisit.back();
+     ToVisit.pop_back();
+     for(size_t np=0; np<Parents[ns].size(); np++)
+      if (!Dirty[Parents[ns][np]])
+       { Dirty[Parents[ns][np]]=true;
+         ToVisit.push_back(Parents[ns][np]);
+       }
+   }
+
+  /*--------------------------------------------------------------*/
+  /*- patch the entity table: entities of structures that need    */
+  /*- not be re-flattened are moved over from the old table      */
+  /*--------------------------------------------------------------*/
+  FlatEntityTable OldTable;
+  vector<iVec> OldCounts;
+  bVec OldFlattened;
+  OldTable.swap(FlatTable);
+  OldCounts.swap(EntityCounts);
+  OldFlattened.swap(Flattened);
+
+  // layers that had not yet been flattened (including new layers)
+  // are left to be flattened on demand
+  iVec OldLayerIndex(Layers.size(), -1);
+  Flattened.assign(Layers.size(), false);
+  for(size_t nl=0; nl<Layers.size(); nl++)
+   { iVec::iterator it = lower_bound(OldLayers.begin(), OldLayers.end(), Layers[nl]);
+     if (it!=OldLayers.end() && *it==Layers[nl])
+      { OldLayerIndex[nl] = it - OldLayers.begin();
+        Flattened[nl] = OldFlattened[OldLayerIndex[nl]];
+      }
+   }
+
+  bVec Reflatten(NumStructs);
+  vector<FlatEntityTable> NewEntities(NumStructs);
+  for(int ns=0; ns<NumStructs; ns++)
+   { bool TopLevel = !(Structs[ns]->IsPCell || Structs[ns]->IsReferenced);
+     Reflatten[ns] = Dirty[ns] || TopLevel!=OldTopLevel[OldIndex[ns]];
+     if (Reflatten[ns] && TopLevel)
+      FlattenStruct(ns, &(NewEntities[ns]), &Flattened);
+   }
+
+  // entities that are carried over came from kept structures,
+  // whose indices may have changed
+  iVec NewIndex(NumOldStructs, -1);
+  for(int ns=0; ns<NumStructs; ns++)
+   if (OldIndex[ns]!=-1)
+    NewIndex[OldIndex[ns]] = ns;
+
+  FlatTable.resize(Layers.size());
+  ClearETable();
+  IntegerTable.clear();     // flattened again on demand
+  IntegerFlattened.clear();
+  ETable.resize(Layers.size());
+  EntityCounts.resize(Layers.size());
+  for(size_t nl=0; nl<Layers.size(); nl++)
+   { 
+     EntityCounts[nl].assign(NumStructs, 0);
+     if (!Flattened[nl]) continue;
+     int nlOld = OldLayerIndex[nl];
+
+     // offsets of the entities of each old structure in the old table
+     iVec OldOffsets(NumOldStructs+1, 0);
+     if (nlOld!=-1)
+      for(int ns=0; ns<NumOldStructs; ns++)
+       OldOffsets[ns+1] = OldOffsets[ns] + OldCounts[nlOld][ns];
+
+     for(int ns=0; ns<NumStructs; ns++)
+      { size_t NumEntities = FlatTable[nl].size();
+        int nsOld = OldIndex[ns];
+        if (Reflatten[ns] && NewEntities[ns].size()>0)
+         FlatTable[nl].Append(NewEntities[ns][nl], 0, NewEntities[ns][nl].size());
+        else if (!Reflatten[ns] && nlOld!=-1)
+         { FlatTable[nl].Append(OldTable[nlOld], OldOffsets[nsOld], OldOffsets[nsOld+1]);
+           for(size_t ne=NumEntities; ne<FlatTable[nl].size(); ne++)
+            FlatTable[nl].Sources[ne].ns = NewIndex[FlatTable[nl].Sources[ne].ns];
+         }
+        EntityCounts[nl][ns] = FlatTable[nl].size() - NumEntities;
+      }
+     if (FlatTable[nl].Offsets.size()==0)
+      FlatTable[nl].Offsets.push_back(0);
+   }
+
+  // release structures that were replaced
+  for(int ns=0; ns<NumOldStructs; ns++)
+   if (!Kept[ns])
+    DeleteGDSIIStruct(OldStructs[ns]);
+  StructExtents.clear();
+
+  return true;
+}
+
+/***************************************************************/
+/* Read a GDSII file in a single streaming pass, reporting its */
+/* content to Visitor as it is read without storing anything.  */
+/* Returns 0 on success or an error message on failure.        */
+/***************************************************************/
+string *VisitGDSIIFile(const char *FileName, GDSIIVisitor *Visitor)
+{
+  GDSIIReader Reader;
+  string *ErrMsg = Reader.Open(FileName);
+  if (ErrMsg)
+   return ErrMsg;
+
+  ParseState PState;
+  InitializeParseState(&PState, 0, Visitor);
+  return ProcessGDSIIRecords(&Reader, &PState);
 }
 
 /***************************************************************/
@@ -801,7 +1819,11 @@ void GDSIIData::WriteDescription(const char *FileName)
   FILE *f = (FileName == 0 ? stdout : fopen(FileName,"w") );
 
   fprintf(f,"*\n");
-  fprintf(f,"* File %s: \n",GDSIIFileName->c_str());
+  if (GDSIIFileNames.size()>1)
+   for(size_t nf=0; nf<GDSIIFileNames.size(); nf++)
+    fprintf(f,"* File %s: \n",GDSIIFileNames[nf].c_str());
+  else
+   fprintf(f,"* File %s: \n",GDSIIFileName ? GDSIIFileName->c_str() : "(stream)");
   if (LibName)
    fprintf(f,"* Library %s: \n",LibName->c_str());
   fprintf(f,"* Unit=%e meters (file units = {%e,%e})\n",UnitInMeters,FileUnits[0],FileUnits[1]);
@@ -847,13 +1869,34 @@ void GDSIIData::WriteDescription(const char *FileName)
 
 /***************************************************************/
 /* non-class utility method to print a raw dump of all data    */
-/* records in a GDSII file                                     */
+/* records in a GDSII file, or (if StructName is non-null) of  */
+/* the library header and the records of that structure only,  */
+/* which is located using the index file                       */
 /***************************************************************/
-bool DumpGDSIIFile(const char *GDSIIFileName)
+bool DumpGDSIIFile(const char *GDSIIFileName, const char *StructName)
 {
-  FILE *f=fopen(GDSIIFileName,"r");
-  if (!f)
-   { fprintf(stderr,"error: could not open %s (aborting)\n",GDSIIFileName);
+  string *ErrMsg=0;
+  size_t HeaderLength=((size_t)-1), Offset=0, EndOffset=0;
+  if (StructName)
+   { GDSIIIndex *Index = GetGDSIIIndex(GDSIIFileName, 0, &ErrMsg);
+     GDSIIIndexEntry *Entry = Index ? FindGDSIIIndexEntry(Index, StructName) : 0;
+     if (Index && !Entry)
+      ErrMsg = new string(string("structure ") + StructName + " not found");
+     if (Entry)
+      { HeaderLength = Index->HeaderLength;
+        Offset       = Entry->Offset;
+        EndOffset    = Entry->Offset + Entry->Length;
+      }
+     if (Index)
+      delete Index;
+   }
+
+  GDSIIReader Reader;
+  if (!ErrMsg)
+   ErrMsg=Reader.Open(GDSIIFileName);
+  if (ErrMsg)
+   { fprintf(stderr,"error: %s (aborting)\n",ErrMsg->c_str());
+     delete ErrMsg;
      return false;
    };
 
@@ -864,21 +1907,30 @@ bool DumpGDSIIFile(const char *GDSIIFileName)
   bool Done=false;
   while(!Done)
    { 
-     string *ErrMsg=0;
-     GDSIIRecord Record=ReadGDSIIRecord(f, &ErrMsg);
+     // jump from the end of the header to the requested structure
+     if (Reader.Tell()==HeaderLength)
+      { printf("...\n");
+        Reader.Seek(Offset);
+      }
+     if (StructName && Reader.Tell()==EndOffset)
+      break;
+
+     GDSIIRecord Record;
+     ErrMsg=ReadGDSIIRecord(&Reader, &Record);
      if (ErrMsg)
       { fprintf(stderr,"error: %s (aborting)\n",ErrMsg->c_str());
+        delete ErrMsg;
         return false;
       }
 
-     string *RStr = GetRecordDescription(Record);
+     string *RStr = GetRecordDescription(&Record);
      printf("Record %i: %s\n",NumRecords++,RStr->c_str());
      delete RStr;
 
      if (Record.RType==RTYPE_ENDLIB)
       Done=true;
    }
-  fclose(f);
+  Reader.Close();
 
   printf("Read %i data records from file %s.\n",NumRecords,GDSIIFileName);
   return true;
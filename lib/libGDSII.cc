@@ -21,6 +21,8 @@
  */
 
 #include "libGDSII.h"
+#include "GDSIIReader.h"
+#include "GDSIIArena.h"
 
 #include <string.h>
 #include <stdarg.h>
@@ -36,13 +38,9 @@ namespace libGDSII {
 /* GDSIIData constructor: create a new GDSIIData instance from */
 /* a binary GDSII file.                                        */
 /***************************************************************/
-GDSIIData::GDSIIData(const string FileName)
+GDSIIData::GDSIIData(const string FileName, const GDSIIReadOptions &Options)
 { 
-  // initialize class data
-  LibName       = 0;
-  FileUnits[0]  = 1.0e-3; // these seem to be the default for GDSII files
-  FileUnits[1]  = 1.0e-9;
-  UnitInMeters  = 1.0e-6;
+  Initialize(Options);
   GDSIIFileName = new string(FileName);
   ReadGDSIIFile(FileName);
 
@@ -50,35 +48,130 @@ GDSIIData::GDSIIData(const string FileName)
   if (ErrMsg) return;
 }
 
+/***************************************************************/
+/* GDSIIData constructors reading GDSII data from memory, from */
+/* a stream, or from a file descriptor.                        */
+/***************************************************************/
+GDSIIData::GDSIIData(const void *Bytes, size_t NumBytes, const GDSIIReadOptions &Options)
+{ 
+  Initialize(Options);
+  GDSIIReader Reader;
+  Reader.Open((const BYTE *)Bytes, NumBytes);
+  ReadGDSIIData(&Reader);
+}
+
+GDSIIData::GDSIIData(istream &Stream, const GDSIIReadOptions &Options)
+{ 
+  Initialize(Options);
+  GDSIIReader Reader;
+  ErrMsg = Reader.Open(Stream);
+  if (ErrMsg) return;
+  ReadGDSIIData(&Reader);
+}
+
+GDSIIData::GDSIIData(int FileDescriptor, const GDSIIReadOptions &Options)
+{ 
+  Initialize(Options);
+  GDSIIReader Reader;
+  ErrMsg = Reader.Open(FileDescriptor);
+  if (ErrMsg) return;
+  ReadGDSIIData(&Reader);
+}
+
+GDSIIData::GDSIIData(const strVec &FileNames, const GDSIIReadOptions &Options)
+{ 
+  Initialize(Options);
+  if (FileNames.size()==0)
+   { ErrMsg = new string("no GDSII files specified");
+     return;
+   }
+  GDSIIFileName  = new string(FileNames[0]);
+  GDSIIFileNames = FileNames;
+  ReadGDSIIFiles(FileNames);
+}
+
+// empty GDSIIData, used internally to hold the contents of one of
+// several files being read
+GDSIIData::GDSIIData()
+{ Initialize(GDSIIReadOptions()); }
+
+void GDSIIData::Initialize(const GDSIIReadOptions &Options)
+{
+  ReadOptions   = Options;
+  ErrMsg        = 0;
+  LibName       = 0;
+  FileUnits[0]  = 1.0e-3; // these seem to be the default for GDSII files
+  FileUnits[1]  = 1.0e-9;
+  UnitInMeters  = 1.0e-6;
+  HeaderHash    = 0;
+  LengthUnit    = 0.0;
+  GDSIIFileName = 0;
+
+  pthread_mutexattr_t Attributes;
+  pthread_mutexattr_init(&Attributes);
+  pthread_mutexattr_settype(&Attributes, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&FlattenMutex, &Attributes);
+  pthread_mutexattr_destroy(&Attributes);
+}
+
 GDSIIData::~GDSIIData()
 {
   if (GDSIIFileName) delete GDSIIFileName;
   if (ErrMsg) delete ErrMsg;
-  for(size_t ns=0; ns<Structs.size(); ns++)
-   { for(size_t ne=0; ne<Structs[ns]->Elements.size(); ne++)
-      { if (Structs[ns]->Elements[ne]->SName) delete Structs[ns]->Elements[ne]->SName;
-        if (Structs[ns]->Elements[ne]->Text)  delete Structs[ns]->Elements[ne]->Text;
-        delete Structs[ns]->Elements[ne];
-      }
-     if (Structs[ns]->Name) delete Structs[ns]->Name;
-     delete Structs[ns];
-   }
+  Clear();
+  pthread_mutex_destroy(&FlattenMutex);
+}
 
-  for(size_t nl=0; nl<ETable.size(); nl++)
-   for(size_t ne=0; ne<ETable[nl].size(); ne++)
-    { if (ETable[nl][ne].Text) free(ETable[nl][ne].Text);
-      if (ETable[nl][ne].Label) free(ETable[nl][ne].Label);
-    }
+/***************************************************************/
+/* Discard everything read from the GDSII file.                */
+/***************************************************************/
+void GDSIIData::Clear()
+{
+  if (LibName) delete LibName;
+  LibName=0;
+  for(size_t ns=0; ns<Structs.size(); ns++)
+   DeleteGDSIIStruct(Structs[ns]);
+  Structs.clear();
+  StructIDs.clear();
+  StructHashes.clear();
+  for(size_t na=0; na<Arenas.size(); na++)
+   delete Arenas[na];
+  Arenas.clear();
+  LayerSet.clear();
+  Layers.clear();
+
+  FlatTable.clear();
+  ClearETable();
+  IntegerTable.clear();
+  IntegerFlattened.clear();
+  Flattened.clear();
+  EntityCounts.clear();
+  StructExtents.clear();
 }
 
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
 int GDSIIData::GetStructByName(string Name)
-{ for(size_t ns=0; ns<Structs.size(); ns++)
-   if ( Name == *(Structs[ns]->Name) )
-    return ns;
-  return -1;
+{ unordered_map<string,int>::iterator it = StructIDs.find(Name);
+  return it==StructIDs.end() ? -1 : it->second;
+}
+
+/***************************************************************/
+/* Delete a structure and its elements. Element storage lives  */
+/* in an arena, which is released here only if it belongs to   */
+/* the structure itself.                                       */
+/***************************************************************/
+void DeleteGDSIIStruct(GDSIIStruct *s)
+{
+  for(size_t ne=0; ne<s->Elements.size(); ne++)
+   { GDSIIElement *e = s->Elements[ne];
+     if (e->Text) delete e->Text;
+     e->~GDSIIElement();
+   }
+  if (s->Name) delete s->Name;
+  if (s->Arena) delete s->Arena;
+  delete s;
 }
 
 /***************************************************************/
@@ -87,21 +180,68 @@ int GDSIIData::GetStructByName(string Name)
 iVec GDSIIData::GetLayers()
 { return Layers; }
 
+// collects the polygons it visits that contain the point (X,Y), or all
+// polygons if X is HUGE_VAL
+class PolygonCollector : public FlatEntityVisitor
+ {
+   public:
+     PolygonCollector(PolygonList *P, double XX, double YY) : Polygons(P), X(XX), Y(YY) {}
+     void Visit(const FlatEntityList &List, size_t ne, double DX, double DY)
+      { if (List.IsText(ne)) return; // we want only polygons here
+        const double *XY = List.Vertices(ne);
+        dVec Polygon(XY, XY + 2*List.NumVertices(ne));
+        if (X!=HUGE_VAL && !PointInPolygon(Polygon, X-DX, Y-DY))
+         return;
+        for(size_t n=0; n<Polygon.size(); n+=2)
+         { Polygon[n+0] += DX;
+           Polygon[n+1] += DY;
+         }
+        Polygons->push_back(Polygon);
+      }
+     PolygonList *Polygons;
+     double X, Y;
+ };
+
+// collects the text strings it visits
+class TextStringCollector : public FlatEntityVisitor
+ {
+   public:
+     TextStringCollector(TextStringList *T, int L) : TextStrings(T), Layer(L) {}
+     void Visit(const FlatEntityList &List, size_t ne, double DX, double DY)
+      { if (!List.IsText(ne)) return;
+        const double *XY = List.Vertices(ne);
+        TextString TS;
+        TS.Text  = (char *)List.Text(ne);
+        TS.XY    = dVec(2);
+        TS.XY[0] = XY[0] + DX;
+        TS.XY[1] = XY[1] + DY;
+        TS.Layer = Layer;
+        TextStrings->push_back(TS);
+      }
+     TextStringList *TextStrings;
+     int Layer;
+ };
+
 PolygonList GDSIIData::GetPolygons(const char *Text, int Layer)
 {
   PolygonList Polygons;
   
   // first pass to find text strings matching Text, if it is non-NULL
+  // (the first match is never a repeated copy, which would follow
+  // the original)
   int TextLayer=-1;
   double TextXY[2]={HUGE_VAL, HUGE_VAL};
   if (Text)
-   { for(size_t nl=0; nl<Layers.size() && TextLayer==-1; nl++)
+   { if (Layer==-1) FlattenLayers();
+     for(size_t nl=0; nl<Layers.size() && TextLayer==-1; nl++)
       { if (Layer!=-1 && Layers[nl]!=Layer) continue;
-        for(size_t ne=0; ne<ETable[nl].size() && TextLayer==-1; ne++)
-         if ( ETable[nl][ne].Text && !strcmp(ETable[nl][ne].Text,Text) )
-          { TextLayer  = Layers[nl];
-            TextXY[0]  = ETable[nl][ne].XY[0];
-            TextXY[1]  = ETable[nl][ne].XY[1];
+        const FlatEntityList &Entities = GetFlatEntities(nl);
+        for(size_t nt=0; nt<Entities.Texts.size() && TextLayer==-1; nt++)
+         if ( !strcmp(Entities.Texts[nt],Text) )
+          { const double *XY = Entities.Vertices(Entities.TextEntities[nt]);
+            TextLayer  = Layers[nl];
+            TextXY[0]  = XY[0];
+            TextXY[1]  = XY[1];
           }
       }
      if (TextLayer==-1) return Polygons; // text string not found, return empty list
@@ -110,13 +250,11 @@ PolygonList GDSIIData::GetPolygons(const char *Text, int Layer)
   if (TextLayer!=-1) Layer=TextLayer;
 
   // second pass to find matching polygons
+  if (Layer==-1) FlattenLayers();
   for(size_t nl=0; nl<Layers.size(); nl++)
    { if (Layer!=-1 && Layers[nl]!=Layer) continue;
-     for(size_t ne=0; ne<ETable[nl].size(); ne++)
-      { if (ETable[nl][ne].Text!=0) continue; // we want only polygons here
-        if (TextLayer==-1 || PointInPolygon(ETable[nl][ne].XY, TextXY[0], TextXY[1]))
-         Polygons.push_back(ETable[nl][ne].XY);
-      }
+     PolygonCollector Collector(&Polygons, TextXY[0], TextXY[1]);
+     GetFlatEntities(nl).Expand(&Collector);
    }
   return Polygons;
 }
@@ -124,10 +262,26 @@ PolygonList GDSIIData::GetPolygons(const char *Text, int Layer)
 PolygonList GDSIIData::GetPolygons(int Layer) 
  { return GetPolygons(0,Layer); }
 
-TextString NewTextString(Entity E, int Layer)
+PolygonList GDSIIData::GetPolygons(const BoundingBox &Window, int Layer)
+{
+  FlatEntityTable Table;
+  FlattenWindow(Window, &Table, Layer==-1 ? iVec() : iVec(1,Layer));
+
+  PolygonList Polygons;
+  for(size_t nl=0; nl<Table.size(); nl++)
+   for(size_t ne=0; ne<Table[nl].size(); ne++)
+    if (!Table[nl].IsText(ne))
+     { const double *XY = Table[nl].Vertices(ne);
+       Polygons.push_back( dVec(XY, XY + 2*Table[nl].NumVertices(ne)) );
+     }
+  return Polygons;
+}
+
+TextString NewTextString(const FlatEntityList &Entities, size_t nt, int Layer)
 { TextString TS;
-  TS.Text  = E.Text;
-  TS.XY    = dVec(E.XY);
+  const double *XY = Entities.Vertices(Entities.TextEntities[nt]);
+  TS.Text  = (char *)Entities.Texts[nt];
+  TS.XY    = dVec(XY, XY+2);
   TS.Layer = Layer;
   return TS;
 }
@@ -135,11 +289,17 @@ TextString NewTextString(Entity E, int Layer)
 TextStringList GDSIIData::GetTextStrings(int Layer)
 { 
   TextStringList TextStrings;
+  if (Layer==-1) FlattenLayers();
   for(size_t nl=0; nl<Layers.size(); nl++)
    { if (Layer!=-1 && Layers[nl]!=Layer) continue;
-     for(size_t ne=0; ne<ETable[nl].size(); ne++)
-      if ( ETable[nl][ne].Text )
-       TextStrings.push_back( NewTextString( ETable[nl][ne], Layers[nl] ) );
+     const FlatEntityList &Entities = GetFlatEntities(nl);
+     if (Entities.Repetitions.size()>0)
+      { TextStringCollector Collector(&TextStrings, Layers[nl]);
+        Entities.Expand(&Collector);
+      }
+     else
+      for(size_t nt=0; nt<Entities.Texts.size(); nt++)
+       TextStrings.push_back( NewTextString( Entities, nt, Layers[nl] ) );
    }
   return TextStrings;
 }
@@ -340,6 +500,21 @@ char *GDSIIData::vstrdup(const char *format, ...)
   return strdup(buffer);
 }
 
+/***************************************************************/
+/* resolve a requested thread count: a positive value is used  */
+/* as is; otherwise the environment variable                   */
+/* LIBGDSII_NUM_THREADS is consulted, with a default of 1.     */
+/***************************************************************/
+int GDSIIData::GetNumThreads(int NumThreads)
+{
+  if (NumThreads>0)
+   return NumThreads;
+  char *s=getenv("LIBGDSII_NUM_THREADS");
+  if (s && 1==sscanf(s,"%i",&NumThreads) && NumThreads>0)
+   return NumThreads;
+  return 1;
+}
+
 } // namespace libGSDII
 
 /***************************************************************/
@@ -26,11 +26,14 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <math.h>
+#include <pthread.h>
 
 #include <string>
 #include <vector>
 #include <set>
 #include <sstream>
+#include <istream>
+#include <unordered_map>
 
 using namespace std;
 
@@ -64,6 +67,9 @@ typedef vector<dVec> PolygonList;
 typedef struct { char *Text; dVec XY; int Layer; } TextString;
 typedef vector<TextString> TextStringList;
 
+// axis-aligned rectangle {XMin, YMin, XMax, YMax}
+typedef struct BoundingBox { double XMin, YMin, XMax, YMax; } BoundingBox;
+
 /***************************************************************/
 /* Data structures used to process GDSII files.                */
 /*  (a) GDSIIElement and GDSIIStruct are used to store info    */
@@ -96,12 +102,26 @@ typedef vector<TextString> TextStringList;
 /***************************************************************/
 enum ElementType { BOUNDARY, PATH, SREF, AREF, TEXT, NODE, BOX };
 
+namespace libGDSII { class GDSIIArena; class GDSIIReader; }
+
+/***************************************************************/
+/* XY coordinates of an element, stored in the arena that holds*/
+/* the element: XY[2*nv+0, 2*nv+1] are the x,y coordinates of  */
+/* vertex #nv, as integer multiples of the database unit.      */
+/***************************************************************/
+typedef struct XYArray
+ { int *Values;
+   size_t Size;
+   size_t size() const { return Size; }
+   int operator[](size_t n) const { return Values[n]; }
+ } XYArray;
+
 typedef struct GDSIIElement
  { 
    ElementType Type;
    int Layer, DataType, TextType, PathType;
-   iVec XY;
-   std::string *SName;
+   XYArray XY;
+   const std::string *SName; // interned; shared by all references to a structure
    int Width, Columns, Rows;
    int nsRef;
    std::string *Text;
@@ -118,6 +138,10 @@ typedef struct GDSIIStruct
    bool IsReferenced;
    std::string *Name;
 
+   // storage for Elements, if owned by the structure itself (see
+   // ReadGDSIIStruct); 0 for structures owned by a GDSIIData
+   libGDSII::GDSIIArena *Arena;
+
  } GDSIIStruct;
 
 typedef struct Entity
@@ -130,11 +154,157 @@ typedef struct Entity
 typedef vector<Entity>     EntityList;
 typedef vector<EntityList> EntityTable;
 
+// the GDSII element from which an entity was obtained:
+// element #ne of structure #ns (see GDSIIData::GetLabel())
+typedef struct EntitySource
+ { int ns, ne;
+ } EntitySource;
+
+// a regular array of copies of entities First...Last-1 of a
+// FlatEntityList, which are themselves the copy in column 0 and
+// row 0; the copy in column nc and row nr is displaced from them
+// by nc*ColumnXY + nr*RowXY
+typedef struct Repetition
+ { size_t First, Last;
+   int Columns, Rows;
+   double ColumnXY[2], RowXY[2];
+ } Repetition;
+
+struct FlatEntityList;
+
+// passed to FlatEntityList::Expand(), which calls Visit() for each
+// entity: entity #ne of List, displaced by (DX, DY)
+class FlatEntityVisitor
+ {
+   public:
+     virtual ~FlatEntityVisitor() {}
+     virtual void Visit(const FlatEntityList &List, size_t ne, double DX, double DY)=0;
+ };
+
+/***************************************************************/
+/* A FlatEntityList holds the same information as an           */
+/* EntityList in structure-of-arrays form, so that the         */
+/* vertices of all entities on a layer occupy one contiguous   */
+/* buffer and flattening does not allocate storage for each    */
+/* entity. Entity #ne has the NumVertices(ne) vertices         */
+/* starting at Vertices(ne); its text string, if it is a text  */
+/* entity, is found by Text(ne). In place of a label, each     */
+/* entity records the element it came from. If the hierarchy   */
+/* was flattened with GDSIIReadOptions::CompactArrays, the     */
+/* list may also contain Repetitions of its entities, in which */
+/* case Expand() visits every copy of every entity, in the     */
+/* order in which they would otherwise have been stored.       */
+/***************************************************************/
+enum { ENTITY_CLOSED=1, ENTITY_TEXT=2, ENTITY_PLACEHOLDER=4 };
+
+typedef struct FlatEntityList
+ { dVec XY;                    // XY[2*nv+0, 2*nv+1] = coordinates of vertex #nv, for all entities in turn
+   vector<size_t> Offsets;     // entity #ne has vertices Offsets[ne]...Offsets[ne+1]-1
+   vector<unsigned char> Flags;// Flags[ne] = combination of ENTITY_CLOSED, ENTITY_TEXT, ENTITY_PLACEHOLDER
+   vector<const char *> Texts; // Texts[nt] = text string of entity #TextEntities[nt], owned by its GDSIIElement
+   vector<size_t> TextEntities;// in increasing order
+   vector<EntitySource> Sources; // Sources[ne] = origin of entity #ne
+
+   // in lists flattened in integer mode (see GDSIIData::GetIntegerEntities()),
+   // XY is empty, and IXY holds the vertex coordinates in database units
+   vector<long long> IXY;
+
+   // in order of First, with each repetition preceding those
+   // of the entities it repeats
+   vector<Repetition> Repetitions;
+
+   size_t size() const { return Flags.size(); }
+   size_t NumVertices(size_t ne) const { return Offsets[ne+1] - Offsets[ne]; }
+   const double *Vertices(size_t ne) const { return XY.data() + 2*Offsets[ne]; }
+   const long long *IntegerVertices(size_t ne) const { return IXY.data() + 2*Offsets[ne]; }
+   bool Closed(size_t ne) const { return Flags[ne] & ENTITY_CLOSED; }
+   bool IsText(size_t ne) const { return Flags[ne] & ENTITY_TEXT; }
+   const char *Text(size_t ne) const; // 0 for polygons
+
+   // number of entities, counting every copy, and visits to them
+   size_t NumExpanded() const;
+   void Expand(FlatEntityVisitor *Visitor) const;
+
+   // copy entities First...Last-1 of List to the end of this list
+   void Append(const FlatEntityList &List, size_t First, size_t Last);
+ } FlatEntityList;
+
+typedef vector<FlatEntityList> FlatEntityTable;
+
+// size of the flattened content of a structure (or of the whole
+// design) on one layer, as predicted by GDSIIData::EstimateFlatSize()
+typedef struct FlatSize
+ { int Layer;              // GDSII layer number
+   size_t NumPolygons;     // boundaries and paths
+   size_t NumTexts;
+   size_t NumVertices;
+   size_t NumRepetitions;  // compact-array mode only
+   size_t NumBytes;        // memory occupied in a FlatEntityList
+ } FlatSize;
+
+typedef vector<FlatSize> FlatSizeList;
+
+// extent on layer Layers[nl] of the content of a structure (including the
+// structures it references), in the structure's own coordinates in GDSII
+// database units: the bounding box of all vertices (of path centerlines,
+// for paths), and half the width of the widest path (which is not
+// magnified by SREFs)
+typedef struct LayerExtent
+ { int nl;
+   BoundingBox Box;
+   double HalfWidth;
+ } LayerExtent;
+
 /**********************************************************************/
 /* GDSIIData is the main class that reads and stores a GDSII geometry.*/
 /**********************************************************************/
 namespace libGDSII
 {
+  /***************************************************************/
+  /* options controlling how a GDSII file is read ****************/
+  /***************************************************************/
+  typedef struct GDSIIReadOptions
+   { 
+     // number of threads used to parse structures and flatten the
+     // hierarchy concurrently; if 0, the environment variable
+     // LIBGDSII_NUM_THREADS is consulted, and if that is not set
+     // the file is read and flattened serially
+     int NumThreads;
+
+     // if nonempty, read only the library header and the structure
+     // of this name, which is located using the sidecar index file
+     // IndexFileName (default: FileName.idx, created if missing
+     // or out of date); references to other structures are ignored
+     std::string StructName;
+     std::string IndexFileName;
+
+     // if nonempty (and StructName is empty), read only this
+     // structure and the structures it references, directly or
+     // indirectly, skipping all others; these are also located
+     // via the index file
+     std::string TopCell;
+
+     // if nonempty, only BOUNDARY, PATH, TEXT, BOX and NODE elements
+     // on these layers (and with these datatypes, or texttypes for
+     // TEXT elements) are read; all others are discarded as they
+     // are parsed, without storing their coordinates
+     iVec Layers, DataTypes;
+
+     // if true, record a content hash of each structure as it is
+     // read, so that a later call to Reload() need only re-read
+     // the structures that have changed in the meantime
+     bool Reloadable;
+
+     // if true, each AREF of more than one instance is flattened as
+     // its first instance together with a Repetition record, which
+     // is only expanded into the other instances when the entities
+     // are visited (see FlatEntityList::Expand())
+     bool CompactArrays;
+
+     GDSIIReadOptions() { NumThreads=0; Reloadable=false; CompactArrays=false; }
+
+   } GDSIIReadOptions;
+
   /***************************************************************/
   /* GDSIIData describes the content of a single GDSII file. *****/
   /***************************************************************/
@@ -146,9 +316,50 @@ namespace libGDSII
      public:
       
        // construct from a binary GDSII file 
-       GDSIIData(const std::string FileName);
+       GDSIIData(const std::string FileName,
+                 const GDSIIReadOptions &Options=GDSIIReadOptions());
+
+       // construct from the NumBytes bytes of GDSII data at Bytes,
+       // which need only remain valid for the duration of the call
+       GDSIIData(const void *Bytes, size_t NumBytes,
+                 const GDSIIReadOptions &Options=GDSIIReadOptions());
+
+       // construct from GDSII data read from a stream or a file
+       // descriptor (e.g. 0 for stdin, or a pipe), which need not be
+       // seekable and is not closed; reading stops after the ENDLIB
+       // record. A file descriptor is read ahead on a separate thread
+       // while it is parsed. The data may be gzip-compressed (if
+       // libGDSII was built with zlib).
+       // Options.StructName and Options.TopCell are not supported.
+       GDSIIData(std::istream &Stream,
+                 const GDSIIReadOptions &Options=GDSIIReadOptions());
+       GDSIIData(int FileDescriptor,
+                 const GDSIIReadOptions &Options=GDSIIReadOptions());
+
+       // construct from several GDSII files (e.g. a top-level design
+       // and the cell libraries it uses), which are read concurrently
+       // (by default on one thread per file) and merged into a single
+       // hierarchy in which SREFs and AREFs may refer to structures in
+       // any of the files. If a structure name occurs in more than one
+       // file, the structure from the first such file is used.
+       // Coordinates are expressed in the finest database unit among
+       // the files (a warning is given if converting to it rounds any
+       // coordinate, and ErrMsg is set if one overflows).
+       // Options.TopCell, if set, selects the structures reachable
+       // from the top cell; Options.StructName is not supported.
+       GDSIIData(const strVec &FileNames,
+                 const GDSIIReadOptions &Options=GDSIIReadOptions());
        ~GDSIIData();
 
+       // bring the data up to date after the GDSII file has been
+       // modified. If the structures were hashed when they were read
+       // (see GDSIIReadOptions::Reloadable), only structures whose
+       // content has changed are re-read, and only the entities
+       // contributed by those structures and the structures that
+       // reference them are re-flattened; otherwise the whole file
+       // is read again. Returns false (and sets ErrMsg) on failure.
+       bool Reload();
+
        void WriteDescription(const char *FileName=0);
 
        // list of layer indices
@@ -162,6 +373,82 @@ namespace libGDSII
        PolygonList GetPolygons(int Layer=-1);
        TextStringList GetTextStrings(int Layer=-1);
 
+       // the hierarchy is flattened one layer at a time, the first
+       // time the entities on a layer are needed; FlattenLayers()
+       // flattens the given layers (all layers if LayerList is empty)
+       // in advance, which is cheaper than flattening them one by one.
+       // The queries below (and FlattenWindow(), FlattenCell(), and
+       // FlatEntityIterator) may be used concurrently from several
+       // threads, as the tables they build on demand are guarded by
+       // a lock; Reload() must not run concurrently with any of them.
+       void FlattenLayers(const iVec &LayerList=iVec());
+
+       // entities on layer GetLayers()[nl], flattened if necessary;
+       // GetEntities() returns the same entities as an EntityList,
+       // which is built (at the cost of a copy of each entity's
+       // vertices, and of formatting its label) the first time it
+       // is requested. The strings belong to the GDSIIData in both
+       // cases. GetETable() builds the entity lists of all layers and
+       // returns the table ETable that holds them, so that ETable[nl]
+       // is GetEntities(nl); ETable itself is filled only as entity
+       // lists are requested.
+       const FlatEntityList &GetFlatEntities(size_t nl);
+       const EntityList &GetEntities(size_t nl);
+       EntityTable &GetETable();
+
+       // descriptive label of an entity, e.g. "Struct TOP element #3 (boundary)"
+       std::string GetLabel(const EntitySource &Source);
+
+       // integer mode: the entities on layer GetLayers()[nl], with
+       // vertex coordinates stored as 64-bit integer multiples of the
+       // database unit (in the IXY field; XY is left empty), which are
+       // computed in integer arithmetic for translations, reflections
+       // and rotations by multiples of 90 degrees (other transforms,
+       // the outlines of paths and AREFs whose pitch is not a whole
+       // number of database units are rounded to the nearest database
+       // unit, the latter with a warning). These are kept in a
+       // separate table, flattened on demand like the first; in the
+       // length unit LengthUnit (in meters; the length unit of
+       // vertex coordinates if 0), a database unit is GetDBUnit().
+       void FlattenIntegerLayers(const iVec &LayerList=iVec());
+       const FlatEntityList &GetIntegerEntities(size_t nl);
+       double GetDBUnit(double LengthUnit=0.0);
+
+       // flatten only the parts of the hierarchy whose bounding boxes
+       // intersect the rectangle Window (in the length unit of vertex
+       // coordinates). FlattenWindow() appends to (*Table)[nl] each
+       // entity on layer GetLayers()[nl] (for the layers in LayerList,
+       // or all layers if it is empty) whose bounding box intersects
+       // Window. GetPolygons() returns the polygons among them on
+       // layer Layer (all layers if Layer==-1).
+       void FlattenWindow(const BoundingBox &Window, FlatEntityTable *Table,
+                          const iVec &LayerList=iVec());
+       PolygonList GetPolygons(const BoundingBox &Window, int Layer=-1);
+
+       // flatten only the structure named TopCell (whether or not it
+       // is a top-level structure), appending to (*Table)[nl] its
+       // entities on layer GetLayers()[nl] (for the layers in
+       // LayerList, or all layers if it is empty). If MaxDepth is
+       // nonnegative, the instances placed by references nested more
+       // than MaxDepth levels below TopCell are not flattened; each
+       // such reference is represented, on each layer on which its
+       // instances have content, by a rectangle outlining their
+       // bounding box, flagged ENTITY_PLACEHOLDER and attributed to
+       // the reference element. Returns false (and sets ErrMsg) if
+       // there is no structure named TopCell.
+       bool FlattenCell(const char *TopCell, FlatEntityTable *Table, int MaxDepth=-1,
+                        const iVec &LayerList=iVec());
+
+       // predict, without flattening anything, what FlattenLayers()
+       // would produce for the layers in LayerList (all layers if it
+       // is empty): the return value has one entry for each layer on
+       // which the flattened design has content. If CellSizes is
+       // nonzero, (*CellSizes)[ns] likewise describes the flattened
+       // content of structure Structs[ns] alone. The cost is linear in
+       // the size of the hierarchy, as each structure is counted once.
+       FlatSizeList EstimateFlatSize(const iVec &LayerList=iVec(),
+                                     vector<FlatSizeList> *CellSizes=0);
+
      /*--------------------------------------------------------*/
      /* API data fields                                        */
      /*--------------------------------------------------------*/
@@ -172,26 +459,63 @@ namespace libGDSII
      /*--------------------------------------------------------*/
 // private:
     // constructor helper methods
+      GDSIIData();
+      void Initialize(const GDSIIReadOptions &Options);
       void ReadGDSIIFile(const std::string FileName, double CoordinateLengthUnit=0.0);
+      void ReadGDSIIFiles(const strVec &FileNames, double CoordinateLengthUnit=0.0);
+      void ReadGDSIIData(GDSIIReader *Reader, double CoordinateLengthUnit=0.0);
+      void ProcessStructs(double CoordinateLengthUnit);
       int GetStructByName(std::string Name);
+      void ResolveReferences();
       void Flatten(double CoordinateLengthUnit=0.0);
+      void FlattenStruct(int ns, FlatEntityTable *Table, const bVec *LayerMask=0);
+      void ClearETable();
+      void Clear();
 
      /*--------------------------------------------------------*/
      /* variables intended for internal use                    */
      /*--------------------------------------------------------*/
 
      // general info on the GDSII file
+     GDSIIReadOptions ReadOptions;
      std::string *LibName;
-     std::string *GDSIIFileName;
+     std::string *GDSIIFileName; // 0 if not read from a file
+     strVec GDSIIFileNames;      // all files read, if more than one
      double FileUnits[2], UnitInMeters;
      set<int> LayerSet; 
      iVec Layers;
 
      // list of structures (hierarchical, i.e. pre-flattening)
      vector<GDSIIStruct *> Structs;
+     std::unordered_map<std::string, int> StructIDs; // StructIDs[Name] = index in Structs
+
+     // storage for the elements of all structures
+     vector<GDSIIArena *> Arenas;
 
-     // table of entities (flattened)
-     EntityTable ETable; // ETable[nl][ne] = #neth entity on layer Layers[nl]
+     // content hashes of the library header and of each structure,
+     // used by Reload(); StructHashes is empty unless
+     // ReadOptions.Reloadable was set
+     unsigned long long HeaderHash;
+     vector<unsigned long long> StructHashes; // StructHashes[ns] = hash of Structs[ns]
+
+     // table of entities (flattened); FlatTable[nl] is empty until
+     // layer Layers[nl] has been flattened (see GetFlatEntities())
+     FlatEntityTable FlatTable; // FlatTable[nl] = entities on layer Layers[nl]
+     bVec Flattened;     // Flattened[nl] = true once FlatTable[nl] has been built
+     vector<iVec> EntityCounts; // EntityCounts[nl][ns] = number of entities in FlatTable[nl] from Structs[ns]
+     EntityTable ETable; // ETable[nl] = FlatTable[nl] as an EntityList, once requested
+                         // (see GetEntities(), GetETable()); the labels of these entities belong to it
+     FlatEntityTable IntegerTable; // as FlatTable, in integer mode (see GetIntegerEntities())
+     bVec IntegerFlattened;
+
+     // StructExtents[ns] lists the extent of structure ns on each layer
+     // on which it has content, in order of layer index; computed when
+     // first needed by FlattenWindow()
+     vector< vector<LayerExtent> > StructExtents;
+
+     // (recursive) lock held while the tables above are built on demand
+     pthread_mutex_t FlattenMutex;
+     double LengthUnit;  // length unit (in meters) of entity vertex coordinates
 
      /*--------------------------------------------------------*/
      /*- utility routines -------------------------------------*/
@@ -203,8 +527,135 @@ namespace libGDSII
      static void Warn(const char *format, ...);
      static char *vstrappend(char *s, const char *format, ...);
      static char *vstrdup(const char *format, ...);
+     static int GetNumThreads(int NumThreads=0);
    };
 
+/***************************************************************/
+/* A FlatEntityIterator flattens the hierarchy of a GDSIIData  */
+/* one entity at a time, without storing the flattened         */
+/* entities: each call to Next() resumes the depth-first walk  */
+/* of the hierarchy (kept on an explicit stack of structures,  */
+/* as deep as the hierarchy) where the previous call left off, */
+/* and stops at the next polygon or text entity on the layers  */
+/* in LayerList (all layers if it is empty). Entities are      */
+/* produced in the order in which FlattenLayers() stores them  */
+/* on each layer; AREFs are always expanded. Memory use does   */
+/* not grow with the size of the flattened design. The         */
+/* GDSIIData must not be modified (e.g. reloaded) while it is  */
+/* being iterated.                                             */
+/*                                                             */
+/*  FlatEntityIterator It(Data, LayerList);                    */
+/*  while( It.Next() )                                         */
+/*   { const FlatEntityList &E = It.Entity();                  */
+/*     ... It.Layer(), E.Vertices(0), E.NumVertices(0), ...    */
+/*   }                                                         */
+/***************************************************************/
+struct FlatIteratorState;
+
+class FlatEntityIterator
+ {
+   public:
+     FlatEntityIterator(GDSIIData *Data, const iVec &LayerList=iVec());
+     ~FlatEntityIterator();
+
+     // advance to the next entity; returns false when there are no more
+     bool Next();
+
+     // the current entity (valid until the next call to Next()), as
+     // entity #0 of a one-entity list, and its GDSII layer number
+     const FlatEntityList &Entity() const;
+     int Layer() const;
+
+   private:
+     FlatIteratorState *State;
+     FlatEntityIterator(const FlatEntityIterator &);            // not copyable
+     FlatEntityIterator &operator=(const FlatEntityIterator &);
+ };
+
+/***************************************************************/
+/* GDSIIVisitor is an interface for reading a GDSII file in a  */
+/* single streaming pass without building GDSIIData: pass an   */
+/* instance of a subclass to VisitGDSIIFile(), and its methods */
+/* are called as the corresponding records are read. Nothing   */
+/* is retained between calls, so memory usage is independent   */
+/* of file size.                                               */
+/*                                                             */
+/* For each element, BeginElement() is followed by Layer(),    */
+/* XY() and Property() events (in file order), and finally by  */
+/* EndElement(), which is passed a GDSIIElement whose scalar   */
+/* fields (datatype, width, SName, Text, transform, etc.) have */
+/* been filled in; its XY and property fields are left empty,  */
+/* as those data have already been reported by the XY() and    */
+/* Property() events. Pointers passed to any method are only   */
+/* valid for the duration of the call.                         */
+/***************************************************************/
+class GDSIIVisitor
+ {
+   public:
+     virtual ~GDSIIVisitor() {}
+
+     virtual void BeginLibrary(const char * /*LibName*/) {}
+     virtual void Units(double /*UserUnit*/, double /*MeterUnit*/) {}
+     virtual void EndLibrary() {}
+
+     virtual void BeginStruct(const char * /*Name*/) {}
+     virtual void EndStruct() {}
+
+     virtual void BeginElement(ElementType /*Type*/) {}
+     virtual void Layer(int /*Layer*/) {}
+     virtual void XY(const int * /*XY*/, int /*NumValues*/) {}
+     virtual void Property(int /*Attr*/, const char * /*Value*/) {}
+     virtual void EndElement(const GDSIIElement * /*Element*/) {}
+ };
+
+// returns 0 on success or an error message (to be deleted by the caller)
+std::string *VisitGDSIIFile(const char *FileName, GDSIIVisitor *Visitor);
+
+/***************************************************************/
+/* A GDSIIIndex records the location and a summary of each     */
+/* structure in a GDSII file, allowing individual structures   */
+/* to be read without parsing the rest of the file. Indices    */
+/* are stored in sidecar text files (by default FileName.idx)  */
+/* that are recreated automatically when the GDSII file        */
+/* changes.                                                    */
+/***************************************************************/
+typedef struct GDSIIIndexEntry
+ { std::string Name;
+   size_t Offset, Length; // byte range of BGNSTR...ENDSTR records in the file
+   strVec Children;       // names of structures referenced by SREFs and AREFs
+   iVec Layers;           // layers on which the structure has elements
+ } GDSIIIndexEntry;
+
+typedef struct GDSIIIndex
+ { size_t FileSize;       // size and modification time (seconds and
+   long FileTime;         //  nanoseconds) of the GDSII file at the
+   long FileTimeNS;       //  time the index was built
+   size_t HeaderLength;   // byte length of the library header
+   unsigned long long HeaderHash; // hash of the library header bytes
+   vector<GDSIIIndexEntry> Entries;
+ } GDSIIIndex;
+
+// scan a GDSII file to build its index; returns 0 on success
+// or an error message (to be deleted by the caller)
+std::string *BuildGDSIIIndex(const char *GDSIIFileName, GDSIIIndex *Index);
+
+// write or read an index file; return false on failure
+bool WriteGDSIIIndex(GDSIIIndex *Index, const char *IndexFileName);
+bool ReadGDSIIIndex(const char *IndexFileName, GDSIIIndex *Index);
+
+// get the index of a GDSII file from its index file, (re)building
+// the index file first if necessary; returns 0 on failure
+GDSIIIndex *GetGDSIIIndex(const char *GDSIIFileName, const char *IndexFileName=0,
+                          std::string **ErrMsg=0);
+GDSIIIndexEntry *FindGDSIIIndexEntry(GDSIIIndex *Index, const char *StructName);
+
+// read a single structure using the index; SREF and AREF elements
+// are left unresolved (nsRef==-1). Returns 0 on failure. The
+// structure should eventually be deleted by DeleteGDSIIStruct().
+GDSIIStruct *ReadGDSIIStruct(const char *GDSIIFileName, const char *StructName,
+                             std::string **ErrMsg=0, const char *IndexFileName=0);
+void DeleteGDSIIStruct(GDSIIStruct *s);
+
 /***************************************************************/
 /* non-class-method geometric primitives ***********************/
 /***************************************************************/
@@ -227,7 +678,7 @@ void ClearGDSIICache();
 /***************************************************************/
 /* non-class method utility routines                           */
 /***************************************************************/
-bool DumpGDSIIFile(const char *FileName);
+bool DumpGDSIIFile(const char *FileName, const char *StructName=0);
 void WriteGMSHEntity(Entity E, int Layer, const char *geoFileName, FILE **pgeoFile,
                      const char *ppFileName=0, FILE **pppFile=0);
 void WriteGMSHFile(EntityTable ETable, iVec Layers, char *FileBase, bool SeparateLayers=false);
@@ -0,0 +1,341 @@
+/* Copyright (C) 2005-2017 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * FlattenTest.cc -- check that the different ways of flattening a
+ *                -- hierarchy agree with FlattenLayers()
+ *
+ * hierarchy.gds has two top-level structures that place a leaf cell
+ * (a boundary, a wide path, a zero-width path and a text) through
+ * SREFs and AREFs with rotations by 30, 45, 90, 180 and 270 degrees,
+ * reflection and magnification (also combined with rotations by
+ * multiples of 90 degrees), nested three levels deep, including
+ * an AREF whose pitch is not a whole number of database units.
+ */
+
+#ifdef HAVE_CONFIG_H
+  #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <string>
+
+#include "libGDSII.h"
+
+using namespace std;
+using namespace libGDSII;
+
+static int NumFailures=0;
+
+static void Check(bool OK, const char *Test)
+{
+  printf("%-60s %s\n",Test,OK ? "ok" : "FAILED");
+  if (!OK) NumFailures++;
+}
+
+static GDSIIData *ReadTestFile(int NumThreads, bool CompactArrays)
+{
+  const char *srcdir = getenv("srcdir");
+  string FileName = string(srcdir ? srcdir : ".") + "/hierarchy.gds";
+  GDSIIReadOptions Options;
+  Options.NumThreads    = NumThreads;
+  Options.CompactArrays = CompactArrays;
+  GDSIIData *Data = new GDSIIData(FileName, Options);
+  if (Data->ErrMsg)
+   { fprintf(stderr,"%s: %s\n",FileName.c_str(),Data->ErrMsg->c_str());
+     exit(1);
+   }
+  return Data;
+}
+
+/***************************************************************/
+/* true if entity #nb of B, displaced by (DX,DY), agrees with  */
+/* entity #na of A to within Tol in each vertex coordinate     */
+/***************************************************************/
+static bool SameEntity(const FlatEntityList &A, size_t na, const FlatEntityList &B, size_t nb,
+                       double Tol, double DX=0.0, double DY=0.0)
+{
+  if (    A.NumVertices(na)!=B.NumVertices(nb) || A.Flags[na]!=B.Flags[nb]
+       || A.Sources[na].ns!=B.Sources[nb].ns || A.Sources[na].ne!=B.Sources[nb].ne )
+   return false;
+  if (A.IsText(na) && strcmp(A.Text(na), B.Text(nb)))
+   return false;
+  const double *XYA = A.Vertices(na), *XYB = B.Vertices(nb);
+  for(size_t n=0; n<A.NumVertices(na); n++)
+   if (    fabs(XYA[2*n+0] - (XYB[2*n+0]+DX)) > Tol
+        || fabs(XYA[2*n+1] - (XYB[2*n+1]+DY)) > Tol )
+    return false;
+  return true;
+}
+
+static bool SameList(const FlatEntityList &A, const FlatEntityList &B)
+{
+  if (A.size()!=B.size() || A.XY!=B.XY || A.Repetitions.size()!=B.Repetitions.size())
+   return false;
+  for(size_t ne=0; ne<A.size(); ne++)
+   if (!SameEntity(A, ne, B, ne, 0.0))
+    return false;
+  for(size_t nr=0; nr<A.Repetitions.size(); nr++)
+   { const Repetition &RA = A.Repetitions[nr], &RB = B.Repetitions[nr];
+     if (    RA.First!=RB.First || RA.Last!=RB.Last || RA.Columns!=RB.Columns || RA.Rows!=RB.Rows
+          || RA.ColumnXY[0]!=RB.ColumnXY[0] || RA.ColumnXY[1]!=RB.ColumnXY[1]
+          || RA.RowXY[0]!=RB.RowXY[0] || RA.RowXY[1]!=RB.RowXY[1] )
+      return false;
+   }
+  return true;
+}
+
+static BoundingBox GetBox(const FlatEntityList &List, size_t ne)
+{
+  BoundingBox B={HUGE_VAL, HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  const double *XY = List.Vertices(ne);
+  for(size_t n=0; n<List.NumVertices(ne); n++)
+   { B.XMin = fmin(B.XMin, XY[2*n+0]);  B.XMax = fmax(B.XMax, XY[2*n+0]);
+     B.YMin = fmin(B.YMin, XY[2*n+1]);  B.YMax = fmax(B.YMax, XY[2*n+1]);
+   }
+  return B;
+}
+
+/***************************************************************/
+/* flattening on several threads gives the same tables as on   */
+/* one thread, with and without compact arrays                 */
+/***************************************************************/
+static void TestThreads(GDSIIData *Serial, bool CompactArrays)
+{
+  GDSIIData *Parallel = ReadTestFile(4, CompactArrays);
+  Serial->FlattenLayers();
+  Parallel->FlattenLayers();
+  bool OK = Serial->Layers==Parallel->Layers;
+  for(size_t nl=0; OK && nl<Serial->Layers.size(); nl++)
+   OK = SameList(Serial->GetFlatEntities(nl), Parallel->GetFlatEntities(nl));
+  Check(OK, CompactArrays ? "4 threads = 1 thread (compact arrays)" : "4 threads = 1 thread");
+  delete Parallel;
+}
+
+/***************************************************************/
+/* expanding the repetitions of the compact-array tables gives */
+/* the tables flattened without them                           */
+/***************************************************************/
+typedef struct Copy { size_t ne; double DX, DY; } Copy;
+
+class CopyCollector : public FlatEntityVisitor
+ { public:
+     vector<Copy> Copies;
+     void Visit(const FlatEntityList &List, size_t ne, double DX, double DY)
+      { (void)List; Copy C={ne, DX, DY}; Copies.push_back(C); }
+ };
+
+static void TestCompactArrays(GDSIIData *Full, GDSIIData *Compact, double Tol)
+{
+  bool OK = Full->Layers==Compact->Layers, Repeated=false;
+  for(size_t nl=0; OK && nl<Full->Layers.size(); nl++)
+   { const FlatEntityList &A = Full->GetFlatEntities(nl), &B = Compact->GetFlatEntities(nl);
+     Repeated = Repeated || B.Repetitions.size()>0;
+     CopyCollector Collector;
+     B.Expand(&Collector);
+     OK = Collector.Copies.size()==A.size() && B.NumExpanded()==A.size();
+     for(size_t n=0; OK && n<A.size(); n++)
+      { const Copy &C = Collector.Copies[n];
+        OK = SameEntity(A, n, B, C.ne, Tol, C.DX, C.DY);
+      }
+   }
+  Check(OK && Repeated, "expanded compact arrays = FlattenLayers()");
+}
+
+/***************************************************************/
+/* the iterator produces the entities of each layer in the     */
+/* order in which FlattenLayers() stores them                  */
+/***************************************************************/
+static void TestIterator(GDSIIData *Data, double Tol)
+{
+  bool OK = true;
+  vector<size_t> Counts(Data->Layers.size(), 0);
+  FlatEntityIterator It(Data);
+  while( OK && It.Next() )
+   { size_t nl;
+     for(nl=0; nl<Data->Layers.size() && Data->Layers[nl]!=It.Layer(); nl++)
+      ;
+     if (nl==Data->Layers.size())
+      { OK=false;
+        break;
+      }
+     const FlatEntityList &List = Data->GetFlatEntities(nl);
+     OK = Counts[nl]<List.size() && SameEntity(List, Counts[nl], It.Entity(), 0, Tol);
+     Counts[nl]++;
+   }
+  for(size_t nl=0; OK && nl<Data->Layers.size(); nl++)
+   OK = Counts[nl]==Data->GetFlatEntities(nl).size();
+  Check(OK, "FlatEntityIterator = FlattenLayers()");
+}
+
+/***************************************************************/
+/* EstimateFlatSize() predicts the flattened tables exactly    */
+/***************************************************************/
+static void TestEstimate(GDSIIData *Data, const char *Test)
+{
+  FlatSizeList Sizes = Data->EstimateFlatSize();
+  bool OK = true;
+  size_t NumNonEmpty=0;
+  for(size_t nl=0; nl<Data->Layers.size(); nl++)
+   { const FlatEntityList &List = Data->GetFlatEntities(nl);
+     if (List.size()==0) continue;
+     NumNonEmpty++;
+     size_t n;
+     for(n=0; n<Sizes.size() && Sizes[n].Layer!=Data->Layers[nl]; n++)
+      ;
+     if (n==Sizes.size())
+      { OK=false;
+        break;
+      }
+     size_t NumTexts = List.Texts.size();
+     OK = OK && Sizes[n].NumTexts==NumTexts
+             && Sizes[n].NumPolygons==List.size()-NumTexts
+             && Sizes[n].NumVertices==List.XY.size()/2
+             && Sizes[n].NumRepetitions==List.Repetitions.size();
+   }
+  Check(OK && NumNonEmpty==Sizes.size(), Test);
+}
+
+/***************************************************************/
+/* windowed flattening returns, in order, a subset of the      */
+/* entities of FlattenLayers() that includes every entity      */
+/* whose bounding box meets the window                         */
+/***************************************************************/
+static bool CheckWindow(GDSIIData *Data, const BoundingBox &Window, double Tol)
+{
+  FlatEntityTable Table;
+  Data->FlattenWindow(Window, &Table);
+  if (Table.size()!=Data->Layers.size())
+   return false;
+  for(size_t nl=0; nl<Data->Layers.size(); nl++)
+   { const FlatEntityList &Full = Data->GetFlatEntities(nl), &Windowed = Table[nl];
+     vector<bool> Found(Full.size(), false);
+     size_t nf=0;
+     for(size_t nw=0; nw<Windowed.size(); nw++, nf++)
+      { while( nf<Full.size() && !SameEntity(Full, nf, Windowed, nw, Tol) )
+         nf++;
+        if (nf==Full.size()) return false;
+        Found[nf]=true;
+      }
+     for(size_t ne=0; ne<Full.size(); ne++)
+      { BoundingBox B = GetBox(Full, ne);
+        bool Meets =    B.XMax > Window.XMin+Tol && B.XMin < Window.XMax-Tol
+                     && B.YMax > Window.YMin+Tol && B.YMin < Window.YMax-Tol;
+        if (Meets && !Found[ne]) return false;
+      }
+   }
+  return true;
+}
+
+static void TestWindows(GDSIIData *Data, const BoundingBox &Extent, double Tol)
+{
+  double W = Extent.XMax - Extent.XMin, H = Extent.YMax - Extent.YMin;
+  double Fractions[][4] = { {0.0, 0.0, 1.0, 1.0},     // everything
+                            {0.0, 0.0, 0.5, 0.5},     // quadrants
+                            {0.5, 0.0, 1.0, 0.5},
+                            {0.0, 0.5, 0.5, 1.0},
+                            {0.5, 0.5, 1.0, 1.0},
+                            {0.45, 0.1, 0.55, 0.9},   // narrow strips
+                            {0.1, 0.62, 0.9, 0.63},
+                            {0.3, 0.3, 0.31, 0.31} }; // a small square
+  bool OK = true;
+  size_t NumWindows = sizeof(Fractions)/sizeof(Fractions[0]);
+  for(size_t n=0; OK && n<NumWindows; n++)
+   { BoundingBox Window;
+     Window.XMin = Extent.XMin + Fractions[n][0]*W;
+     Window.YMin = Extent.YMin + Fractions[n][1]*H;
+     Window.XMax = Extent.XMin + Fractions[n][2]*W;
+     Window.YMax = Extent.YMin + Fractions[n][3]*H;
+     OK = CheckWindow(Data, Window, Tol);
+   }
+  Check(OK, "FlattenWindow() = FlattenLayers() within the window");
+}
+
+/***************************************************************/
+/* GetETable() fills the entity lists of all layers, expanding */
+/* any repetitions                                             */
+/***************************************************************/
+static void TestETable(GDSIIData *Data)
+{
+  EntityTable &ETable = Data->GetETable();
+  bool OK = ETable.size()==Data->Layers.size();
+  for(size_t nl=0; OK && nl<Data->Layers.size(); nl++)
+   OK =    ETable[nl].size()==Data->GetFlatEntities(nl).NumExpanded()
+        && &(ETable[nl])==&(Data->GetEntities(nl));
+  Check(OK, "GetETable() = GetEntities() (compact arrays)");
+}
+
+/***************************************************************/
+/* integer-mode coordinates are those of FlattenLayers(), in   */
+/* database units, to within rounding                          */
+/***************************************************************/
+static void TestInteger(GDSIIData *Data)
+{
+  double DBUnit = Data->GetDBUnit();
+  bool OK = true;
+  for(size_t nl=0; OK && nl<Data->Layers.size(); nl++)
+   { const FlatEntityList &A = Data->GetFlatEntities(nl), &B = Data->GetIntegerEntities(nl);
+     OK = A.Offsets==B.Offsets && A.Flags==B.Flags && B.XY.size()==0 && B.IXY.size()==A.XY.size();
+     for(size_t n=0; OK && n<A.XY.size(); n++)
+      OK = fabs(B.IXY[n]*DBUnit - A.XY[n]) <= 0.5000001*DBUnit;
+   }
+  Check(OK, "integer mode = FlattenLayers() in database units");
+}
+
+int main()
+{
+  GDSIIData *Full    = ReadTestFile(1, false);
+  GDSIIData *Compact = ReadTestFile(1, true);
+  Full->FlattenLayers();
+  Compact->FlattenLayers();
+
+  BoundingBox Extent={HUGE_VAL, HUGE_VAL, -HUGE_VAL, -HUGE_VAL};
+  size_t NumEntities=0;
+  for(size_t nl=0; nl<Full->Layers.size(); nl++)
+   { const FlatEntityList &List = Full->GetFlatEntities(nl);
+     NumEntities += List.size();
+     for(size_t ne=0; ne<List.size(); ne++)
+      { BoundingBox B = GetBox(List, ne);
+        Extent.XMin = fmin(Extent.XMin, B.XMin);  Extent.XMax = fmax(Extent.XMax, B.XMax);
+        Extent.YMin = fmin(Extent.YMin, B.YMin);  Extent.YMax = fmax(Extent.YMax, B.YMax);
+      }
+   }
+  Check(NumEntities>0, "hierarchy.gds flattens to a nonempty design");
+  if (NumEntities==0)
+   return 1;
+
+  // tolerance for coordinates computed along different paths
+  double Tol = 1.0e-9*fmax(Extent.XMax - Extent.XMin, Extent.YMax - Extent.YMin);
+
+  TestThreads(Full, false);
+  TestThreads(Compact, true);
+  TestCompactArrays(Full, Compact, Tol);
+  TestIterator(Full, Tol);
+  TestEstimate(Full, "EstimateFlatSize() = FlattenLayers()");
+  TestEstimate(Compact, "EstimateFlatSize() = FlattenLayers() (compact arrays)");
+  TestWindows(Full, Extent, Tol);
+  TestInteger(Full);
+  TestETable(Compact);
+
+  delete Full;
+  delete Compact;
+  return NumFailures==0 ? 0 : 1;
+}
@@ -0,0 +1,244 @@
+/* Copyright (C) 2005-2017 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/*
+ * PipeTest.cc -- reading GDSII data from pipes, descriptors and streams
+ *             -- whose writer keeps them open after the library
+ */
+
+#ifdef HAVE_CONFIG_H
+  #include "config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <sstream>
+
+#ifdef HAVE_LIBZ
+  #include <zlib.h>
+#endif
+
+#include "libGDSII.h"
+#include "GDSIIReader.h"
+
+using namespace std;
+using namespace libGDSII;
+
+// bytes written after the library, which the reader must leave alone
+#define TRAILER "TRAILER"
+
+static int NumFailures=0;
+
+static void Check(bool OK, const char *Test)
+{
+  printf("%-60s %s\n",Test,OK ? "ok" : "FAILED");
+  if (!OK) NumFailures++;
+}
+
+/***************************************************************/
+/* a small library: one structure with one boundary on layer 1 */
+/* and one text on layer 2                                     */
+/***************************************************************/
+static void AddRecord(string &Bytes, int RType, int DType, const string &Payload=string())
+{
+  size_t Size = 4 + Payload.size();
+  Bytes += (char)(Size>>8);
+  Bytes += (char)(Size&0xFF);
+  Bytes += (char)RType;
+  Bytes += (char)DType;
+  Bytes += Payload;
+}
+
+static string Int2(int n)
+{ string s; s+=(char)((n>>8)&0xFF); s+=(char)(n&0xFF); return s; }
+
+static string Int4(int n)
+{ return Int2((n>>16)&0xFFFF) + Int2(n&0xFFFF); }
+
+static string Real8(double x)
+{ BYTE b[8]={0,0,0,0,0,0,0,0};
+  int Exponent=64;
+  while(x>=1.0)      { x/=16.0; Exponent++; }
+  while(x<1.0/16.0)  { x*=16.0; Exponent--; }
+  b[0]=Exponent;
+  for(int n=1; n<8; n++)
+   { x*=256.0; b[n]=(int)x; x-=b[n]; }
+  return string((const char *)b, 8);
+}
+
+static string Dates()
+{ string s;
+  for(int n=0; n<12; n++) s+=Int2(1);
+  return s;
+}
+
+static string MakeLibrary()
+{
+  string Bytes;
+  AddRecord(Bytes, RTYPE_HEADER,  INTEGER_2, Int2(600));
+  AddRecord(Bytes, RTYPE_BGNLIB,  INTEGER_2, Dates());
+  AddRecord(Bytes, RTYPE_LIBNAME, STRING,    "PIPETEST");
+  AddRecord(Bytes, RTYPE_UNITS,   REAL_8,    Real8(1.0e-3) + Real8(1.0e-9));
+  AddRecord(Bytes, RTYPE_BGNSTR,  INTEGER_2, Dates());
+  AddRecord(Bytes, RTYPE_STRNAME, STRING,    "CELL");
+  AddRecord(Bytes, RTYPE_BOUNDARY, NO_DATA);
+  AddRecord(Bytes, RTYPE_LAYER,    INTEGER_2, Int2(1));
+  AddRecord(Bytes, RTYPE_DATATYPE, INTEGER_2, Int2(0));
+  AddRecord(Bytes, RTYPE_XY,       INTEGER_4, Int4(0)+Int4(0)  + Int4(1000)+Int4(0)
+                                            + Int4(1000)+Int4(500) + Int4(0)+Int4(500)
+                                            + Int4(0)+Int4(0));
+  AddRecord(Bytes, RTYPE_ENDEL, NO_DATA);
+  AddRecord(Bytes, RTYPE_TEXT,     NO_DATA);
+  AddRecord(Bytes, RTYPE_LAYER,    INTEGER_2, Int2(2));
+  AddRecord(Bytes, RTYPE_TEXTTYPE, INTEGER_2, Int2(0));
+  AddRecord(Bytes, RTYPE_XY,       INTEGER_4, Int4(500)+Int4(250));
+  AddRecord(Bytes, RTYPE_STRING,   STRING,    "LABEL");
+  AddRecord(Bytes, RTYPE_ENDEL, NO_DATA);
+  AddRecord(Bytes, RTYPE_ENDSTR, NO_DATA);
+  AddRecord(Bytes, RTYPE_ENDLIB, NO_DATA);
+  return Bytes;
+}
+
+#ifdef HAVE_LIBZ
+static string Compress(const string &Bytes)
+{
+  z_stream Z;
+  memset(&Z, 0, sizeof(Z));
+  deflateInit2(&Z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16+MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+  string Out(deflateBound(&Z, Bytes.size()), 0);
+  Z.next_in   = (Bytef *)Bytes.data();
+  Z.avail_in  = Bytes.size();
+  Z.next_out  = (Bytef *)&Out[0];
+  Z.avail_out = Out.size();
+  deflate(&Z, Z_FINISH);
+  Out.resize(Z.total_out);
+  deflateEnd(&Z);
+  return Out;
+}
+#endif
+
+static bool WriteAll(int fd, const string &Bytes)
+{ return write(fd, Bytes.data(), Bytes.size())==(ssize_t)Bytes.size(); }
+
+static bool ReadTrailer(int fd)
+{ char Buffer[100];
+  ssize_t NumRead = read(fd, Buffer, strlen(TRAILER));
+  return NumRead==(ssize_t)strlen(TRAILER) && !strncmp(Buffer, TRAILER, NumRead);
+}
+
+static bool LibraryOK(GDSIIData *Data)
+{
+  if (Data->ErrMsg)
+   { printf("  error: %s\n",Data->ErrMsg->c_str());
+     return false;
+   }
+  TextStringList Texts = Data->GetTextStrings(2);
+  return    Data->GetPolygons(1).size()==1
+         && Texts.size()==1 && !strcmp(Texts[0].Text, "LABEL");
+}
+
+/***************************************************************/
+/* read a library from a pipe whose write end stays open; with */
+/* the library followed by more data that must remain unread   */
+/***************************************************************/
+static void TestPipe(const string &Bytes, const char *Test, bool CheckTrailer)
+{
+  int FDs[2];
+  if (pipe(FDs)!=0 || !WriteAll(FDs[1], Bytes + TRAILER))
+   { Check(false, Test);
+     return;
+   }
+  GDSIIData *Data = new GDSIIData(FDs[0]);
+  bool OK = LibraryOK(Data);
+  delete Data;
+  if (CheckTrailer)
+   OK = OK && ReadTrailer(FDs[0]);
+  Check(OK, Test);
+  close(FDs[0]);
+  close(FDs[1]);
+}
+
+static void TestSeekableDescriptor(const string &Bytes)
+{
+  FILE *f = tmpfile();
+  bool OK = f && fwrite(Bytes.data(), 1, Bytes.size(), f)==Bytes.size()
+              && fputs(TRAILER, f)>=0 && fflush(f)==0;
+  if (OK)
+   { int fd = fileno(f);
+     lseek(fd, 0, SEEK_SET);
+     GDSIIData *Data = new GDSIIData(fd);
+     OK = LibraryOK(Data) && ReadTrailer(fd);
+     delete Data;
+   }
+  if (f) fclose(f);
+  Check(OK, "seekable descriptor stops after ENDLIB");
+}
+
+static void TestStream(const string &Bytes)
+{
+  istringstream Stream(Bytes + TRAILER);
+  GDSIIData *Data = new GDSIIData(Stream);
+  bool OK = LibraryOK(Data);
+  delete Data;
+  string Rest;
+  Stream >> Rest;
+  Check(OK && Rest==TRAILER, "stream stops after ENDLIB");
+}
+
+/***************************************************************/
+/* closing a reader must not wait for input that never comes   */
+/***************************************************************/
+static void TestClose(const string &Bytes)
+{
+  int FDs[2];
+  bool OK = pipe(FDs)==0 && WriteAll(FDs[1], Bytes.substr(0, Bytes.size()/2));
+  if (OK)
+   { GDSIIReader Reader;
+     string *ErrMsg = Reader.Open(FDs[0]);
+     OK = (ErrMsg==0) && Reader.Peek(4)!=0;
+     Reader.Close();
+
+     GDSIIReader IdleReader;
+     ErrMsg = IdleReader.Open(FDs[0]);
+     OK = OK && ErrMsg==0;
+     IdleReader.Close();
+     close(FDs[0]);
+     close(FDs[1]);
+   }
+  Check(OK, "closing a reader waiting for input");
+}
+
+int main()
+{
+  // a hang is a failure
+  alarm(60);
+
+  string Bytes = MakeLibrary();
+  TestPipe(Bytes, "pipe left open stops after ENDLIB", true);
+#ifdef HAVE_LIBZ
+  TestPipe(Compress(Bytes), "compressed pipe left open", false);
+#endif
+  TestSeekableDescriptor(Bytes);
+  TestStream(Bytes);
+  TestClose(Bytes);
+
+  return NumFailures==0 ? 0 : 1;
+}